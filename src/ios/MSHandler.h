@@ -30,9 +30,13 @@
 
 @property (nonatomic, retain) MoodstocksPlugin *plugin;
 @property (nonatomic, retain) NSString *callback;
+@property (nonatomic, retain) NSDictionary *changelog;
+@property (nonatomic, assign) int progress;
 
 - (id)initWithPlugin:(MoodstocksPlugin *)plugin callback:(NSString *)callback;
 - (void)sync;
+- (void)listenToOfflineQueue;
 - (void)scanResultFound:(NSString *)value format:(int)format;
+- (void)scanResultsFound:(NSArray *)results summary:(NSDictionary *)summary;
 
 @end
@@ -29,6 +29,8 @@
 
 @synthesize plugin = _plugin;
 @synthesize callback = _callback;
+@synthesize changelog = _changelog;
+@synthesize progress = _progress;
 
 - (id)initWithPlugin:(MoodstocksPlugin *)plugin callback:(NSString *)callback {
     self = [super init];
@@ -36,16 +38,21 @@
     if (self) {
         self.plugin = plugin;
         self.callback = callback;
+        self.progress = -1;
     }
     
     return self;
 }
 
 - (void)dealloc {
-    [super dealloc];
+#if MS_SDK_REQUIREMENTS
+    [[[MSScanner sharedInstance] offlineDelegates] removeObject:self];
+#endif
+    [_plugin release];
+    [_callback release];
+    [_changelog release];
     
-    self.plugin = nil;
-    self.callback = nil;
+    [super dealloc];
 }
 
 - (void)sync {
@@ -58,6 +65,16 @@
 #endif
 }
 
+- (void)listenToOfflineQueue {
+#if MS_SDK_REQUIREMENTS
+    MSScanner *scanner = [MSScanner sharedInstance];
+    if (![[scanner offlineDelegates] containsObject:self])
+        [[scanner offlineDelegates] addObject:self];
+    // Catch up with the searches queued so far (no-op if offline)
+    [scanner flushOfflineQueueWithDelegate:nil];
+#endif
+}
+
 #pragma mark - Sync Handler
 
 - (void)scannerWillSync:(MSScanner *)scanner {
@@ -65,16 +82,28 @@
                            status:1
                          progress:0
                          callback:self.callback
-               shouldKeepCallback:YES];
+               shouldKeepCallback:YES
+                          changes:nil];
 }
 
 - (void)didSyncWithProgress:(NSNumber *)current total:(NSNumber *)total {
+    // NOTE: the total is unknown (-1) or 0 until the SDK has listed the changes
+    if ([total intValue] <= 0) return;
     int percent = 100 * [current floatValue] / [total floatValue];
+    // NOTE: the WebView only gets the percentage so do not bother it with the same one twice
+    if (percent == self.progress) return;
+    self.progress = percent;
+    
     [self.plugin returnSyncStatus:@""
                            status:2
                          progress:percent
                          callback:self.callback
-               shouldKeepCallback:YES];
+               shouldKeepCallback:YES
+                          changes:nil];
+}
+
+- (void)scanner:(MSScanner *)scanner didSyncWithChangelog:(MSSyncChangelog *)changelog {
+    self.changelog = [changelog dictionary];
 }
 
 - (void)scannerDidSync:(MSScanner *)scanner {
@@ -83,7 +112,8 @@
                            status:3
                          progress:100
                          callback:self.callback
-               shouldKeepCallback:NO];
+               shouldKeepCallback:NO
+                          changes:self.changelog];
     
     [self release];
 }
@@ -96,16 +126,33 @@
                                status:0
                              progress:0
                              callback:self.callback
-                   shouldKeepCallback:YES];
+                   shouldKeepCallback:YES
+                              changes:nil];
     }
     
     [self release];
 }
 
+#pragma mark - Offline Queue Handler
+
+- (void)scanner:(MSScanner *)scanner didSearchQueuedQuery:(MSQueuedQuery *)query
+     withResult:(MSResult *)result
+          error:(NSError *)error {
+    [self.plugin returnQueuedQuery:query
+                            result:result
+                             error:error
+                           pending:[[scanner offlineQueue] count]
+                          callback:self.callback];
+}
+
 #pragma mark - Scanner Session Handler
 
 - (void)scanResultFound:(NSString *)value format:(int)format {
     [self.plugin returnScanResult:value format:format callback:self.callback];
 }
 
+- (void)scanResultsFound:(NSArray *)results summary:(NSDictionary *)summary {
+    [self.plugin returnScanResults:results summary:summary callback:self.callback];
+}
+
 @end
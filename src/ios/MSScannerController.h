@@ -47,11 +47,39 @@ MSActivityViewDelegate
     UIBarButtonItem *_barButton;
     UITapGestureRecognizer *_tapRecognizer;
     NSInteger _scanOptions;
+    // Continuous mode
+    BOOL _continuous;
+    NSTimeInterval _dedupeWindow;
+    NSTimeInterval _batchInterval;
+    NSMutableDictionary *_seen;
+    NSMutableArray *_batch;
+    BOOL _flushPending;
+    BOOL _finished;
+    CFAbsoluteTime _startTime;
+    NSUInteger _items;
+    NSUInteger _messages;
 }
 
 - (id)initWithHandler:(MSHandler *)handler scanOptions:(NSInteger)scanOptions;
 
+/**
+ * Keep scanning after a result has been found instead of dismissing the scanner.
+ *
+ * New results are sent to the handler in batches (see `batchInterval`) until
+ * `dismissAction` is called, i.e. the user taps `Done` or the plugin `stop`s.
+ */
+- (id)initWithHandler:(MSHandler *)handler
+          scanOptions:(NSInteger)scanOptions
+           continuous:(BOOL)continuous;
+
+- (void)dismissAction;
+
 @property (nonatomic, retain) MSHandler *handler;
+@property (nonatomic, readonly) BOOL continuous;
+// Time during which a result that keeps being scanned is not reported again (default: 5 seconds)
+@property (nonatomic, assign) NSTimeInterval dedupeWindow;
+// Time during which new results are gathered before being sent at once (default: 0.5 second)
+@property (nonatomic, assign) NSTimeInterval batchInterval;
 
 @end
 
@@ -34,7 +34,9 @@
 - (void)showFlash;
 - (void)setActivityView:(BOOL)show;
 - (void)snapAction:(UIGestureRecognizer *)gestureRecognizer;
-- (void)dismissAction;
+- (void)foundResult:(MSResult *)result;
+- (void)flushBatch;
+- (void)sendBatch:(BOOL)finished;
 
 - (void)handleVideoRotation;
 
@@ -43,18 +45,36 @@
 @implementation MSScannerController
 
 @synthesize handler = _handler;
+@synthesize continuous = _continuous;
+@synthesize dedupeWindow = _dedupeWindow;
+@synthesize batchInterval = _batchInterval;
 
 - (id)initWithHandler:(MSHandler *)handler scanOptions:(NSInteger)scanOptions {
+    return [self initWithHandler:handler scanOptions:scanOptions continuous:NO];
+}
+
+- (id)initWithHandler:(MSHandler *)handler
+          scanOptions:(NSInteger)scanOptions
+           continuous:(BOOL)continuous {
     self = [super init];
     if (self) {
 
         self.handler = handler;
         _scanOptions = scanOptions;
+        _continuous = continuous;
+        _dedupeWindow = 5.0;
+        _batchInterval = 0.5;
+        if (_continuous) {
+            _seen = [[NSMutableDictionary alloc] init];
+            _batch = [[NSMutableArray alloc] init];
+        }
         
         _scannerSession = [[MSScannerSession alloc] initWithScanner:[MSScanner sharedInstance]];
 #if MS_SDK_REQUIREMENTS
         [_scannerSession setScanOptions:_scanOptions];
         [_scannerSession setDelegate:self];
+        // A continuous scan reports every barcode in sight, not only the first one
+        if (_continuous) [[_scannerSession engine] setMultiDecode:YES];
 #endif
     }
     
@@ -62,10 +82,15 @@
 }
 
 - (void)dealloc {
-    [super dealloc];
-    
-    self.handler = nil;
+    // Cancel the pending batch flush, if any
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(flushBatch) object:nil];
+    [_handler release];
+    [_scannerSession setDelegate:nil];
     [_scannerSession release];
+    [_seen release];
+    [_batch release];
+    
+    [super dealloc];
 }
 
 - (void)loadView {
@@ -117,6 +142,7 @@
     [videoPreviewLayer insertSublayer:captureLayer below:[[videoPreviewLayer sublayers] objectAtIndex:0]];
     
     [_scannerSession startCapture];
+    _startTime = CFAbsoluteTimeGetCurrent();
     
     NSDictionary *state = [NSDictionary dictionaryWithObjectsAndKeys:
                            [NSNumber numberWithBool:!!(_scanOptions & MS_RESULT_TYPE_EAN8)],   @"decode_ean_8",
@@ -132,7 +158,7 @@
     _toolbar.tintColor = nil;
     
     _barButton = [[[UIBarButtonItem alloc]
-                   initWithBarButtonSystemItem:UIBarButtonSystemItemCancel
+                   initWithBarButtonSystemItem:(_continuous ? UIBarButtonSystemItemDone : UIBarButtonSystemItemCancel)
                    target:self
                    action:@selector(dismissAction)] autorelease];
     
@@ -254,9 +280,89 @@
     }
 }
 
+- (void)foundResult:(MSResult *)result {
+    // NOTE: results of frames already in flight may still come after the first one
+    if (_finished) return;
+    
+    if (!_continuous) {
+        [_scannerSession pause];
+        
+        [self.handler scanResultFound:[result getValue] format:[result getType]];
+        [self dismissAction];
+        return;
+    }
+    
+    // The locked result is reported at every frame: only report it again once
+    // it has been out of sight for the whole window (e.g. not while aiming at it)
+    NSString *key = [NSString stringWithFormat:@"%d:%@", [result getType], [result getValue]];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSNumber *lastSeen = [_seen objectForKey:key];
+    [_seen setObject:[NSNumber numberWithDouble:now] forKey:key];
+    if (lastSeen != nil && now - [lastSeen doubleValue] < _dedupeWindow) return;
+    
+    _items++;
+    [_batch addObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithInt:[result getType]], @"format",
+                                                                 [result getValue], @"value",
+                                                                 nil]];
+    
+    // Gather the results found in the meantime to cross the JS bridge once
+    if (!_flushPending) {
+        _flushPending = YES;
+        [self performSelector:@selector(flushBatch) withObject:nil afterDelay:_batchInterval];
+    }
+}
+
+- (void)flushBatch {
+    _flushPending = NO;
+    // NOTE: the final batch is sent by `dismissAction`
+    if (!_finished && [_batch count] > 0) [self sendBatch:NO];
+}
+
+- (void)sendBatch:(BOOL)finished {
+    NSDictionary *summary = nil;
+    
+    _messages++;
+    if (finished) {
+        NSTimeInterval duration = CFAbsoluteTimeGetCurrent() - _startTime;
+        double itemsPerMinute = (duration > 0) ? 60 * _items / duration : 0;
+        double messagesPerSecond = (duration > 0) ? _messages / duration : 0;
+        MSDLog(@" [MOODSTOCKS SDK] CONTINUOUS SCAN: %u ITEM(S) IN %.1fs (%.1f/MIN), %u MESSAGE(S) (%.2f/S)",
+               (unsigned) _items, duration, itemsPerMinute, (unsigned) _messages, messagesPerSecond);
+        
+        summary = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:_items], @"items",
+                                                             [NSNumber numberWithUnsignedInteger:_messages], @"messages",
+                                                             [NSNumber numberWithDouble:duration], @"duration",
+                                                             [NSNumber numberWithDouble:itemsPerMinute], @"itemsPerMinute",
+                                                             [NSNumber numberWithDouble:messagesPerSecond], @"messagesPerSecond",
+                                                             nil];
+    }
+    
+    [self.handler scanResultsFound:[NSArray arrayWithArray:_batch] summary:summary];
+    [_batch removeAllObjects];
+    
+    // Forget about the results that went out of sight for the whole window
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSMutableArray *expired = [NSMutableArray array];
+    for (NSString *key in _seen) {
+        if (now - [[_seen objectForKey:key] doubleValue] >= _dedupeWindow) [expired addObject:key];
+    }
+    [_seen removeObjectsForKeys:expired];
+}
+
 - (void)dismissAction {
+    if (_finished) return;
+    _finished = YES;
+    
     [_scannerSession stopCapture];
     [_scannerSession cancel];
+    
+    // Send the pending results along with the summary that closes the callback
+    if (_continuous) {
+        [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(flushBatch) object:nil];
+        _flushPending = NO;
+        [self sendBatch:YES];
+    }
+    
     [self dismissModalViewControllerAnimated:YES];
 }
 
@@ -265,18 +371,22 @@
 #if MS_SDK_REQUIREMENTS
 - (void)session:(MSScannerSession *)scanner didScan:(MSResult *)result {
     if (result != nil){
-        [_scannerSession pause];
+        if (!_continuous) [_scannerSession pause];
         
         dispatch_async(dispatch_get_main_queue(), ^{
-            NSString *value = [result getValue];
-            int format = [result getType];
-                    
-            [self.handler scanResultFound:value format:format];
-            [self dismissAction];
+            [self foundResult:result];
         });
     }
 }
 
+- (void)session:(MSScannerSession *)scanner didScanCodes:(NSArray *)codes {
+    // NOTE: the code already reported through `session:didScan:` is de-duplicated
+    dispatch_async(dispatch_get_main_queue(), ^{
+        for (MSResult *code in codes)
+            [self foundResult:code];
+    });
+}
+
 - (void)session:(MSScannerSession *)scanner failedToScan:(NSError *)error {
     MSDLog(@" [MOODSTOCKS SDK] SCAN ERROR: %@", MSErrMsg([error code]));
 }
@@ -293,13 +403,7 @@
     [self setActivityView:NO];
     
     if (result != nil) {
-        [_scannerSession pause];
-        
-        NSString *value = [result getValue];
-        int format = [result getType];
-        
-        [self.handler scanResultFound:value format:format];
-        [self dismissAction];
+        [self foundResult:result];
     }
     else {
         [[[[UIAlertView alloc] initWithTitle:@"No match found"
@@ -310,6 +414,19 @@
     }
 }
 
+- (void)scanner:(MSScanner *)scanner didQueueSearch:(MSQueuedQuery *)query {
+    [[UIApplication sharedApplication] setNetworkActivityIndicatorVisible:NO];
+    [self setActivityView:NO];
+    
+    MSDLog(@" [MOODSTOCKS SDK] NO CONNECTION: SEARCH QUEUED (%@)", [query identifier]);
+    
+    [[[[UIAlertView alloc] initWithTitle:@"No connection"
+                                 message:@"The search has been saved and will be performed once online."
+                                delegate:nil
+                       cancelButtonTitle:@"OK"
+                       otherButtonTitles:nil] autorelease] show];
+}
+
 - (void)scanner:(MSScanner *)scanner failedToSearchWithError:(NSError *)error {
     [[UIApplication sharedApplication] setNetworkActivityIndicatorVisible:NO];
     [self setActivityView:NO];
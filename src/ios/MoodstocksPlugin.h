@@ -24,20 +24,42 @@
 #import <Foundation/Foundation.h>
 #import <Cordova/CDV.h>
 
+#import "MSOfflineQueue.h"
+#import "MSResult.h"
+
+@class MSHandler;
+
 @interface MoodstocksPlugin : CDVPlugin
 
+@property (nonatomic, retain) MSHandler *queueHandler;
+
 - (void)open:(CDVInvokedUrlCommand *)command;
 - (void)sync:(CDVInvokedUrlCommand *)command;
 - (void)scan:(CDVInvokedUrlCommand *)command;
+- (void)info:(CDVInvokedUrlCommand *)command;
+- (void)queue:(CDVInvokedUrlCommand *)command;
+- (void)stats:(CDVInvokedUrlCommand *)command;
+- (void)stop:(CDVInvokedUrlCommand *)command;
 
 - (void)returnScanResult:(NSString *)value
                   format:(int)format
                 callback:(NSString *)callback;
 
+- (void)returnScanResults:(NSArray *)results
+                  summary:(NSDictionary *)summary
+                 callback:(NSString *)callback;
+
 - (void)returnSyncStatus:(NSString *)message
                   status:(int)status
                 progress:(int)progress
                 callback:(NSString *)callback
-      shouldKeepCallback:(BOOL)shouldKeepCallback;
+      shouldKeepCallback:(BOOL)shouldKeepCallback
+                 changes:(NSDictionary *)changes;
+
+- (void)returnQueuedQuery:(MSQueuedQuery *)query
+                   result:(MSResult *)result
+                    error:(NSError *)error
+                  pending:(NSUInteger)pending
+                 callback:(NSString *)callback;
 
 @end
\ No newline at end of file
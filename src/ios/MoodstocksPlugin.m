@@ -29,6 +29,9 @@
 #import "MSHandler.h"
 
 #import "MSDebug.h"
+#import "MSTrace.h"
+#import "MSImagePool.h"
+#import "MSSync.h"
 
 #include "moodstocks_sdk.h"
 
@@ -40,8 +43,34 @@
 
 @class MSScannerController;
 
+// Numeric argument at `index`, or nil if it is missing or not a number (e.g. `null`)
+static NSNumber *ms_number_arg(CDVInvokedUrlCommand *command, NSUInteger index) {
+    NSArray *args = command.arguments;
+    id arg = (index < [args count]) ? [args objectAtIndex:index] : nil;
+    return [arg isKindOfClass:[NSNumber class]] ? arg : nil;
+}
+
+// Counters of a latency histogram, durations in milliseconds
+static NSDictionary *ms_histogram_dict(const MSHistogram *h) {
+    return [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInt:h->count], @"count",
+                                                      [NSNumber numberWithDouble:1000 * MSHistogramMean(h)], @"mean",
+                                                      [NSNumber numberWithDouble:1000 * MSHistogramPercentile(h, 0.5)], @"p50",
+                                                      [NSNumber numberWithDouble:1000 * MSHistogramPercentile(h, 0.9)], @"p90",
+                                                      [NSNumber numberWithDouble:1000 * MSHistogramPercentile(h, 0.99)], @"p99",
+                                                      [NSNumber numberWithDouble:1000 * h->max], @"max",
+                                                      nil];
+}
+
 @implementation MoodstocksPlugin
 
+@synthesize queueHandler = _queueHandler;
+
+- (void)dealloc {
+    self.queueHandler = nil;
+    
+    [super dealloc];
+}
+
 // Plugin method - open: load the scanner with given api key & secret pair
 - (void)open:(CDVInvokedUrlCommand *)command {
     CDVPluginResult *pluginResult = nil;
@@ -96,13 +125,21 @@
 // Plugin method - scan: set scan options & launch the scanner
 - (void)scan:(CDVInvokedUrlCommand *) command {
     // Get the scan options
-    NSInteger scanOptions = [[command.arguments objectAtIndex:0] integerValue];
+    NSInteger scanOptions = [ms_number_arg(command, 0) integerValue];
+    // Get the continuous mode options: de-duplication window (s) & batch interval (ms)
+    // NOTE: missing options (e.g. from an older JS side) fall back to a non-continuous scan
+    BOOL continuous = [ms_number_arg(command, 1) boolValue];
+    double window = [ms_number_arg(command, 2) doubleValue];
+    double interval = [ms_number_arg(command, 3) doubleValue];
     
     MSHandler *scanHandler = [[MSHandler alloc] initWithPlugin:self callback:command.callbackId];
     
     // Initialize the scanner view controller
     MSScannerController *scannerController = [[MSScannerController alloc] initWithHandler:scanHandler
-                                                                              scanOptions:scanOptions];
+                                                                              scanOptions:scanOptions
+                                                                               continuous:continuous];
+    if (window > 0) scannerController.dedupeWindow = window;
+    if (interval > 0) scannerController.batchInterval = interval / 1000.0;
 
     [self.viewController presentModalViewController:scannerController animated:YES];
     
@@ -110,6 +147,189 @@
     [scanHandler release];    
 }
 
+// Plugin method - stop: dismiss the scanner (e.g. to end a continuous scan)
+- (void)stop:(CDVInvokedUrlCommand *)command {
+    UIViewController *presented = [self.viewController modalViewController];
+    if ([presented isKindOfClass:[MSScannerController class]])
+        [(MSScannerController *)presented dismissAction];
+    
+    CDVPluginResult *pluginResult = [CDVPluginResult resultWithStatus:CDVCommandStatus_OK];
+    [self.commandDelegate sendPluginResult:pluginResult callbackId:command.callbackId];
+}
+
+// Plugin method - info: get a page of the image IDs recorded into the cache
+- (void)info:(CDVInvokedUrlCommand *)command {
+    // Get the paging options: offset, limit & prefix
+    // NOTE: missing or invalid options fall back to the JS side defaults
+    NSNumber *offsetArg = ms_number_arg(command, 0);
+    NSNumber *limitArg = ms_number_arg(command, 1);
+    NSUInteger offset = ([offsetArg integerValue] > 0) ? [offsetArg unsignedIntegerValue] : 0;
+    NSUInteger limit = (limitArg != nil && [limitArg integerValue] >= 0) ? [limitArg unsignedIntegerValue] : 100;
+    id prefix = ([command.arguments count] > 2) ? [command.arguments objectAtIndex:2] : nil;
+    if (![prefix isKindOfClass:[NSString class]] || [prefix length] == 0) prefix = nil;
+    
+    // NOTE: listing the IDs may take a while without the index, so do not block the main thread
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        CDVPluginResult *pluginResult = nil;
+        
+#if MS_SDK_REQUIREMENTS
+        NSError *err = nil;
+        NSUInteger total = 0;
+        NSArray *ids = [[MSScanner sharedInstance] infoWithPrefix:prefix
+                                                           offset:offset
+                                                            limit:limit
+                                                            total:&total
+                                                            error:&err];
+        if (err != nil) {
+            pluginResult = [CDVPluginResult resultWithStatus:CDVCommandStatus_ERROR
+                                             messageAsString:MSErrMsg([err code])];
+        }
+        else {
+            NSDictionary *pageDict = [NSDictionary dictionaryWithObjectsAndKeys:ids, @"ids",
+                                                                                [NSNumber numberWithUnsignedInteger:offset], @"offset",
+                                                                                [NSNumber numberWithUnsignedInteger:total], @"total",
+                                                                                nil];
+            pluginResult = [CDVPluginResult resultWithStatus:CDVCommandStatus_OK
+                                         messageAsDictionary:pageDict];
+        }
+#else
+        pluginResult = [CDVPluginResult resultWithStatus:CDVCommandStatus_ERROR
+                                         messageAsString:@"Your device is not compatible with the Moodstocks SDK."];
+#endif
+        
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self.commandDelegate sendPluginResult:pluginResult callbackId:command.callbackId];
+        });
+    });
+}
+
+// Plugin method - queue: get the results of the searches queued while offline
+- (void)queue:(CDVInvokedUrlCommand *)command {
+    // NOTE: only the last registered callback is kept
+    MSHandler *queueHandler = [[MSHandler alloc] initWithPlugin:self callback:command.callbackId];
+    self.queueHandler = queueHandler;
+    [queueHandler listenToOfflineQueue];
+    [queueHandler release];
+    
+    CDVPluginResult *pluginResult = [CDVPluginResult resultWithStatus:CDVCommandStatus_NO_RESULT];
+    [pluginResult setKeepCallbackAsBool:YES];
+    [self.commandDelegate sendPluginResult:pluginResult callbackId:command.callbackId];
+}
+
+// Plugin method - stats: get the latency histograms & counters collected so far
+- (void)stats:(CDVInvokedUrlCommand *)command {
+    BOOL reset = [ms_number_arg(command, 0) boolValue];
+    
+    NSMutableDictionary *statsDict = [NSMutableDictionary dictionary];
+    
+    // Latency of each traced stage, in milliseconds
+    MSTraceStats trace;
+    MSTraceSnapshot(&trace);
+    NSMutableDictionary *traceDict = [NSMutableDictionary dictionary];
+    for (int i = 0; i < MS_TRACE_STAGES; i++) {
+        const MSHistogram *h = &trace.stages[i];
+        if (h->count == 0) continue;
+        [traceDict setObject:ms_histogram_dict(h) forKey:[NSString stringWithUTF8String:MSTraceStageName(i)]];
+    }
+    [statsDict setObject:traceDict forKey:@"latency"];
+    
+    // Tracing overhead: number of events times the cost of recording one (in nanoseconds)
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedLongLong:trace.events], @"events",
+                                                                    [NSNumber numberWithUnsignedLongLong:trace.dropped], @"dropped",
+                                                                    [NSNumber numberWithDouble:1e9 * trace.cost], @"cost",
+                                                                    nil]
+                  forKey:@"tracing"];
+    
+    // Pixel buffers pool: hit rate = hits / (hits + misses)
+    MSImagePoolStats pool = [[MSImagePool sharedPool] stats];
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:pool.hits], @"hits",
+                                                                    [NSNumber numberWithUnsignedInteger:pool.misses], @"misses",
+                                                                    [NSNumber numberWithUnsignedLongLong:pool.residentBytes], @"residentBytes",
+                                                                    [NSNumber numberWithUnsignedLongLong:pool.peakBytes], @"peakBytes",
+                                                                    nil]
+                  forKey:@"pool"];
+    
+#if MS_SDK_REQUIREMENTS
+    MSScanner *scanner = [MSScanner sharedInstance];
+    
+    MSApiClient *apiClient = [scanner apiClient];
+    MSApiClientStats api = [apiClient stats];
+    
+    // Latency of the hybrid searches, per winning path
+    MSHistogram local = [apiClient histogramForPath:MS_SEARCH_PATH_LOCAL];
+    MSHistogram online = [apiClient histogramForPath:MS_SEARCH_PATH_API];
+    MSHistogram none = [apiClient histogramForPath:MS_SEARCH_PATH_NONE];
+    NSDictionary *hybridDict = [NSDictionary dictionaryWithObjectsAndKeys:ms_histogram_dict(&local), @"local",
+                                                                          ms_histogram_dict(&online), @"api",
+                                                                          ms_histogram_dict(&none), @"none",
+                                                                          nil];
+    
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:api.requests], @"requests",
+                                                                    [NSNumber numberWithUnsignedInteger:api.attempts], @"attempts",
+                                                                    [NSNumber numberWithUnsignedInteger:api.retries], @"retries",
+                                                                    [NSNumber numberWithUnsignedInteger:api.hedges], @"hedges",
+                                                                    [NSNumber numberWithUnsignedInteger:api.hedgeWins], @"hedgeWins",
+                                                                    [NSNumber numberWithUnsignedInteger:api.failures], @"failures",
+                                                                    [NSNumber numberWithUnsignedInteger:api.localWins], @"localWins",
+                                                                    [NSNumber numberWithUnsignedInteger:api.apiWins], @"apiWins",
+                                                                    [NSNumber numberWithUnsignedLongLong:api.bytes], @"bytes",
+                                                                    hybridDict, @"hybrid",
+                                                                    nil]
+                  forKey:@"api"];
+    
+    MSScannerAccessStats access = [scanner accessStats];
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithLongLong:access.shared], @"shared",
+                                                                    [NSNumber numberWithLongLong:access.exclusive], @"exclusive",
+                                                                    [NSNumber numberWithLongLong:access.contended], @"contended",
+                                                                    [NSNumber numberWithDouble:access.waitTime / 1000.0], @"waitTime",
+                                                                    nil]
+                  forKey:@"access"];
+    
+    // Results storage: `created` only grows when a new value is found
+    MSResultStorageStats results = [MSResult storageStats];
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithLongLong:results.live], @"live",
+                                                                    [NSNumber numberWithLongLong:results.created], @"created",
+                                                                    [NSNumber numberWithLongLong:results.reused], @"reused",
+                                                                    nil]
+                  forKey:@"results"];
+    
+    // Multi-code decoding: codes per frame = codes / frames
+    MSScannerMultiDecodeStats multi = [scanner multiDecodeStats];
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithLongLong:multi.frames], @"frames",
+                                                                    [NSNumber numberWithLongLong:multi.regions], @"regions",
+                                                                    [NSNumber numberWithLongLong:multi.decodes], @"decodes",
+                                                                    [NSNumber numberWithLongLong:multi.codes], @"codes",
+                                                                    nil]
+                  forKey:@"multi"];
+    
+    MSOfflineQueue *offlineQueue = [scanner offlineQueue];
+    MSOfflineQueueStats queue = [offlineQueue stats];
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithUnsignedInteger:[offlineQueue count]], @"pending",
+                                                                    [NSNumber numberWithDouble:[offlineQueue oldestAge]], @"oldestAge",
+                                                                    [NSNumber numberWithLongLong:queue.queued], @"queued",
+                                                                    [NSNumber numberWithLongLong:queue.dropped], @"dropped",
+                                                                    [NSNumber numberWithLongLong:queue.retries], @"retries",
+                                                                    [NSNumber numberWithLongLong:queue.delivered], @"delivered",
+                                                                    nil]
+                  forKey:@"queue"];
+    
+    // Sync progress reports received from the SDK vs. notified (see MSSync)
+    MSSyncProgressStats sync = [MSSync progressStats];
+    [statsDict setObject:[NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithLongLong:sync.produced], @"produced",
+                                                                    [NSNumber numberWithLongLong:sync.delivered], @"delivered",
+                                                                    nil]
+                  forKey:@"sync"];
+    
+    [statsDict setObject:[NSNumber numberWithUnsignedInteger:[scanner generation]] forKey:@"generation"];
+#endif
+    
+    if (reset) MSTraceReset();
+    
+    CDVPluginResult *pluginResult = [CDVPluginResult resultWithStatus:CDVCommandStatus_OK
+                                                 messageAsDictionary:statsDict];
+    [self.commandDelegate sendPluginResult:pluginResult callbackId:command.callbackId];
+}
+
 // Scan result callback
 - (void)returnScanResult:(NSString *)value
                   format:(int)format
@@ -128,16 +348,38 @@
     [self writeJavascript:js];
 }
 
+// Continuous scan results callback
+- (void)returnScanResults:(NSArray *)results
+                  summary:(NSDictionary *)summary
+                 callback:(NSString *)callback {
+    NSMutableDictionary *resultsDict = [NSMutableDictionary dictionaryWithObject:results forKey:@"results"];
+    
+    // Throughput of the whole scan (only once the scanner is dismissed)
+    if (summary != nil) [resultsDict setObject:summary forKey:@"summary"];
+    
+    CDVPluginResult *result = [CDVPluginResult resultWithStatus:CDVCommandStatus_OK
+                                            messageAsDictionary:resultsDict];
+    
+    [result setKeepCallbackAsBool:(summary == nil)];
+    
+    NSString *js = [result toSuccessCallbackString:callback];
+    [self writeJavascript:js];
+}
+
 // Sync status callback
 - (void)returnSyncStatus:(NSString *)message
                   status:(int)status
                 progress:(int)progress
                 callback:(NSString *)callback
-      shouldKeepCallback:(BOOL)shouldKeepCallback {
-    NSDictionary *statusDict = [NSDictionary dictionaryWithObjectsAndKeys:message, @"message",
-                                                                          [NSNumber numberWithInt:status], @"status",
-                                                                          [NSNumber numberWithFloat:progress], @"progress",
-                                                                          nil];
+      shouldKeepCallback:(BOOL)shouldKeepCallback
+                 changes:(NSDictionary *)changes {
+    NSMutableDictionary *statusDict = [NSMutableDictionary dictionaryWithObjectsAndKeys:message, @"message",
+                                                                                        [NSNumber numberWithInt:status], @"status",
+                                                                                        [NSNumber numberWithFloat:progress], @"progress",
+                                                                                        nil];
+    
+    // Added, removed & unchanged images (only once the sync is finished)
+    if (changes != nil) [statusDict setObject:changes forKey:@"changes"];
     
     CDVPluginResult *result = [CDVPluginResult resultWithStatus:CDVCommandStatus_OK
                                                 messageAsDictionary:statusDict];
@@ -148,4 +390,32 @@
     [self writeJavascript:js];
 }
 
-@end
+// Queued search callback
+- (void)returnQueuedQuery:(MSQueuedQuery *)query
+                   result:(MSResult *)result
+                    error:(NSError *)error
+                  pending:(NSUInteger)pending
+                 callback:(NSString *)callback {
+    NSMutableDictionary *queryDict = [NSMutableDictionary dictionaryWithObjectsAndKeys:[query identifier], @"id",
+                                                                                       [NSNumber numberWithDouble:1000 * [query timestamp]], @"timestamp",
+                                                                                       [NSNumber numberWithUnsignedInteger:[query attempts]], @"attempts",
+                                                                                       [NSNumber numberWithUnsignedInteger:pending], @"pending",
+                                                                                       nil];
+    
+    // Either the search result (if any) or the error that made the query be dropped
+    if (result != nil) {
+        [queryDict setObject:[NSNumber numberWithInt:[result getType]] forKey:@"format"];
+        [queryDict setObject:[result getValue] forKey:@"value"];
+    }
+    if (error != nil) [queryDict setObject:MSErrMsg([error code]) forKey:@"error"];
+    
+    CDVPluginResult *pluginResult = [CDVPluginResult resultWithStatus:CDVCommandStatus_OK
+                                                 messageAsDictionary:queryDict];
+    
+    [pluginResult setKeepCallbackAsBool:YES];
+    
+    NSString *js = [pluginResult toSuccessCallbackString:callback];
+    [self writeJavascript:js];
+}
+
+@end
\ No newline at end of file
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#include "moodstocks_sdk.h"
+
+#import "MSImage.h"
+#import "MSResult.h"
+#import "MSHistogram.h"
+
+@class MSScanner;
+
+/**
+ * Path that produced the result of a hybrid search
+ */
+typedef enum {
+    MS_SEARCH_PATH_NONE = 0,    /* no match */
+    MS_SEARCH_PATH_LOCAL,       /* offline search */
+    MS_SEARCH_PATH_API          /* online search */
+} MSSearchPath;
+
+/**
+ * Usage counters of an API client
+ */
+typedef struct {
+    NSUInteger requests;    /* number of searches */
+    NSUInteger attempts;    /* number of HTTP requests sent (including retries & hedges) */
+    NSUInteger retries;     /* number of retries after a transient failure */
+    NSUInteger hedges;      /* number of hedged requests */
+    NSUInteger hedgeWins;   /* number of searches won by the hedged request */
+    NSUInteger reuses;      /* number of requests sent on a warm handle */
+    NSUInteger failures;    /* number of searches that failed */
+    NSUInteger localWins;   /* number of hybrid searches won by the offline search */
+    NSUInteger apiWins;     /* number of hybrid searches won by the online search */
+    uint64_t bytes;         /* cumulated size of the queries in bytes (8-bit gray pixels) */
+    NSUInteger lastBytes;   /* size of the last query in bytes */
+    double lastTime;        /* duration of the last search in seconds */
+    double totalTime;       /* cumulated search time in seconds */
+} MSApiClientStats;
+
+/**
+ * Cancellation scope of online searches
+ *
+ * Cancelling a token aborts the searches started with it (see `MSApiClient`)
+ * while the other searches of the client go on. A search started with an
+ * already cancelled token fails right away.
+ *
+ * This class is thread safe.
+ */
+@interface MSApiToken : NSObject {
+    NSMutableSet *_races;
+    NSMutableSet *_children;
+    BOOL _cancelled;
+}
+
+/** Flag indicating whether the token has been cancelled */
+@property (readonly, getter = isCancelled) BOOL cancelled;
+
+/**
+ * Abort the pending searches started with this token, and the next ones
+ */
+- (void)cancel;
+
+@end
+
+/**
+ * Long-lived client for online searches (aka API searches)
+ *
+ * - camera frames are resized before upload so that their largest dimension
+ *   is `longEdge` pixels, which is optionally adapted to the observed latency,
+ * - API handles are kept warm into a small pool instead of being created and
+ *   released for each search,
+ * - transient failures (`MS_UNAVAIL`, `MS_SLOWCONN`, `MS_TIMEOUT`) are retried
+ *   with a jittered exponential backoff as long as the latency budget allows it,
+ * - if a request does not complete within `hedgeDelay`, a second identical
+ *   request is sent on another handle: the first one to succeed wins and the
+ *   other one is cancelled.
+ *
+ * This class is thread safe.
+ */
+@interface MSApiClient : NSObject {
+    MSScanner *_scanner;
+    ms_api_handle_t **_idle;
+    NSUInteger _idleCount;
+    NSUInteger _capacity;
+    NSMutableSet *_races;
+    NSUInteger _generation;
+    dispatch_group_t _leases;
+    BOOL _suspended;
+    NSUInteger _cancels;
+    NSTimeInterval _budget;
+    NSTimeInterval _hedgeDelay;
+    int _longEdge;
+    BOOL _adaptive;
+    MSApiClientStats _stats;
+    MSHistogram _histograms[MS_SEARCH_PATH_API + 1];
+}
+
+/**
+ * Time in seconds after which no more retry is attempted (default: 8)
+ */
+@property (assign) NSTimeInterval budget;
+
+/**
+ * Time in seconds after which a hedged request is sent (default: 2, 0 to
+ * disable hedging)
+ */
+@property (assign) NSTimeInterval hedgeDelay;
+
+/**
+ * Largest dimension in pixels of the uploaded queries (default: 640, 0 to
+ * upload the queries as is)
+ *
+ * It is never below the minimum size accepted by the SDK (480 pixels).
+ */
+@property (assign) int longEdge;
+
+/**
+ * Adapt `longEdge` to the network: it is decreased after a slow search (or a
+ * `MS_SLOWCONN` error) and increased after a fast one (default: YES)
+ */
+@property (assign) BOOL adaptive;
+
+/** Usage counters */
+@property (readonly) MSApiClientStats stats;
+
+/**
+ * Create a client keeping up to `capacity` warm handles
+ */
+- (id)initWithScanner:(MSScanner *)scanner capacity:(NSUInteger)capacity;
+
+/**
+ * Perform an online search (blocking)
+ *
+ * Returns the result found, or `nil` if there is no match or if an error
+ * occurred. A cancelled search fails with `MS_ABORT`.
+ */
+- (MSResult *)search:(MSImage *)qry error:(NSError **)error;
+
+/**
+ * Same as `search:error:` except that the search can be cancelled through
+ * `token` (optional) without affecting the other searches
+ */
+- (MSResult *)search:(MSImage *)qry token:(MSApiToken *)token error:(NSError **)error;
+
+/**
+ * Perform an offline search and an online search concurrently (blocking)
+ *
+ * The first match wins: an offline match cancels the online search, so that
+ * the result is returned as soon as possible when the local database has it
+ * while the misses still fall back to Moodstocks API. `path` (optional)
+ * receives the path that produced the result.
+ */
+- (MSResult *)hybridSearch:(MSImage *)qry path:(MSSearchPath *)path error:(NSError **)error;
+
+/**
+ * Same as `hybridSearch:path:error:` except that the online search can be
+ * cancelled through `token` (optional) without affecting the other searches
+ *
+ * NOTE: an offline match only cancels the online search of this very call.
+ */
+- (MSResult *)hybridSearch:(MSImage *)qry
+                      path:(MSSearchPath *)path
+                     token:(MSApiToken *)token
+                     error:(NSError **)error;
+
+/**
+ * Latency histogram of the hybrid searches that ended with the given path
+ */
+- (MSHistogram)histogramForPath:(MSSearchPath)path;
+
+/**
+ * Cancel all the pending searches, whatever their token (e.g. before the
+ * client goes away)
+ */
+- (void)cancelAll;
+
+/**
+ * Release all the warm handles (e.g. before the scanner is closed)
+ *
+ * The requests in flight are aborted and waited for, and no handle is leased
+ * until `resume` is called, so that no handle outlives the scanner it has been
+ * created from. The aborted requests fail with a transient error, i.e. they
+ * are retried after `resume` if the latency budget allows it.
+ *
+ * NOTE: this must be called without holding any access to the scanner.
+ */
+- (void)drain;
+
+/**
+ * Lease handles again after `drain`
+ */
+- (void)resume;
+
+@end
@@ -0,0 +1,714 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSApiClient.h"
+#import "MSAvailability.h"
+#import "MSScanner.h"
+#import "MSImageProc.h"
+#import "MSTrace.h"
+#import "MSDebug.h"
+#import "MSObjC.h"
+
+#include <stdlib.h>
+
+/** Default latency budget in seconds */
+#define MS_API_CLIENT_BUDGET      8.0
+/** Default hedging delay in seconds */
+#define MS_API_CLIENT_HEDGE_DELAY 2.0
+/** Backoff base delay in seconds (doubled at each retry, then jittered) */
+#define MS_API_CLIENT_RETRY_DELAY 0.25
+/** Default largest dimension of the uploaded queries */
+#define MS_API_CLIENT_LONG_EDGE   640
+/** Search time in seconds above which the queries get smaller */
+#define MS_API_CLIENT_SLOW_TIME   1.5
+/** Search time in seconds below which the queries get larger */
+#define MS_API_CLIENT_FAST_TIME   0.5
+
+static BOOL ms_api_is_transient(ms_errcode ecode) {
+    return !!(ecode == MS_UNAVAIL || ecode == MS_SLOWCONN || ecode == MS_TIMEOUT);
+}
+
+/**
+ * State shared by the (up to 2) requests sent for a single search attempt
+ *
+ * NOTE: all fields are protected by `@synchronized` on the race itself
+ */
+@interface MSApiRace : NSObject {
+@public
+    dispatch_semaphore_t done;
+    ms_api_handle_t *handles[2];
+    int launched;
+    int pending;
+    int winner;
+    BOOL finished;
+    BOOL cancelled;
+    ms_errcode ecode;
+    ms_result_t *result;
+}
+- (void)cancel;
+@end
+
+@implementation MSApiRace
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        done = dispatch_semaphore_create(0);
+        handles[0] = handles[1] = NULL;
+        launched = pending = 0;
+        winner = -1;
+        finished = cancelled = NO;
+        ecode = MS_SUCCESS;
+        result = NULL;
+    }
+    return self;
+}
+
+- (void)dealloc {
+#if MS_SDK_REQUIREMENTS
+    if (result != NULL) ms_result_del(result);
+#endif
+    result = NULL;
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(done);
+#endif
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+// NOTE: the lock must be held
+- (void)cancel {
+    cancelled = YES;
+#if MS_SDK_REQUIREMENTS
+    for (int i = 0; i < 2; i++) {
+        if (handles[i] != NULL) ms_api_handle_cancel(handles[i]);
+    }
+#endif
+}
+
+@end
+
+@interface MSApiToken ()
+- (BOOL)addRace:(MSApiRace *)race;
+- (void)removeRace:(MSApiRace *)race;
+- (BOOL)addChild:(MSApiToken *)child;
+- (void)removeChild:(MSApiToken *)child;
+@end
+
+@implementation MSApiToken
+
+@dynamic cancelled;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        _races = [[NSMutableSet alloc] init];
+        _children = [[NSMutableSet alloc] init];
+        _cancelled = NO;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_races release_stub];
+    _races = nil;
+    [_children release_stub];
+    _children = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (BOOL)isCancelled {
+    @synchronized(self) {
+        return _cancelled;
+    }
+}
+
+- (void)cancel {
+    NSArray *races = nil;
+    NSArray *children = nil;
+    @synchronized(self) {
+        if (_cancelled) return;
+        _cancelled = YES;
+        races = [_races allObjects];
+        children = [_children allObjects];
+    }
+
+    for (MSApiRace *race in races) {
+        @synchronized(race) {
+            [race cancel];
+        }
+    }
+    for (MSApiToken *child in children)
+        [child cancel];
+}
+
+// Returns NO (and does not track the race) if the token has been cancelled
+- (BOOL)addRace:(MSApiRace *)race {
+    @synchronized(self) {
+        if (_cancelled) return NO;
+        [_races addObject:race];
+        return YES;
+    }
+}
+
+- (void)removeRace:(MSApiRace *)race {
+    @synchronized(self) {
+        [_races removeObject:race];
+    }
+}
+
+// Returns NO (and does not track the child) if the token has been cancelled
+- (BOOL)addChild:(MSApiToken *)child {
+    @synchronized(self) {
+        if (_cancelled) return NO;
+        [_children addObject:child];
+        return YES;
+    }
+}
+
+- (void)removeChild:(MSApiToken *)child {
+    @synchronized(self) {
+        [_children removeObject:child];
+    }
+}
+
+@end
+
+/**
+ * State of the offline side of a hybrid search
+ *
+ * NOTE: all fields are protected by `@synchronized` on the object itself
+ */
+@interface MSHybridRace : NSObject {
+@public
+    dispatch_semaphore_t done;
+    MSResult *local;
+    BOOL apiDone;
+}
+@end
+
+@implementation MSHybridRace
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        done = dispatch_semaphore_create(0);
+        local = nil;
+        apiDone = NO;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [local release_stub];
+    local = nil;
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(done);
+#endif
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+@end
+
+@interface MSApiClient ()
+#if MS_SDK_REQUIREMENTS
+- (ms_errcode)race:(MSImage *)qry
+             hedge:(NSTimeInterval)hedge
+             token:(MSApiToken *)token
+            result:(ms_result_t **)result;
+- (void)launch:(MSApiRace *)race query:(MSImage *)qry;
+- (ms_api_handle_t *)leaseHandle:(ms_errcode *)ecode generation:(NSUInteger *)generation;
+- (void)returnHandle:(ms_api_handle_t *)handle generation:(NSUInteger)generation;
+#endif
+@end
+
+@implementation MSApiClient
+
+@dynamic budget;
+@dynamic hedgeDelay;
+@dynamic longEdge;
+@dynamic adaptive;
+@dynamic stats;
+
+- (id)initWithScanner:(MSScanner *)scanner capacity:(NSUInteger)capacity {
+    self = [super init];
+    if (self) {
+        _scanner = scanner;
+        _capacity = capacity;
+        _idle = (ms_api_handle_t **) calloc(capacity > 0 ? capacity : 1, sizeof(ms_api_handle_t *));
+        _idleCount = 0;
+        _races = [[NSMutableSet alloc] init];
+        _generation = 0;
+        _leases = dispatch_group_create();
+        _suspended = NO;
+        _cancels = 0;
+        _budget = MS_API_CLIENT_BUDGET;
+        _hedgeDelay = MS_API_CLIENT_HEDGE_DELAY;
+        _longEdge = MS_API_CLIENT_LONG_EDGE;
+        _adaptive = YES;
+        memset(&_stats, 0, sizeof(_stats));
+        memset(_histograms, 0, sizeof(_histograms));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self drain];
+    free(_idle);
+    _idle = NULL;
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(_leases);
+#endif
+    [_races release_stub];
+    _races = nil;
+    _scanner = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (NSTimeInterval)budget {
+    @synchronized(self) {
+        return _budget;
+    }
+}
+
+- (void)setBudget:(NSTimeInterval)budget {
+    @synchronized(self) {
+        _budget = budget;
+    }
+}
+
+- (NSTimeInterval)hedgeDelay {
+    @synchronized(self) {
+        return _hedgeDelay;
+    }
+}
+
+- (void)setHedgeDelay:(NSTimeInterval)hedgeDelay {
+    @synchronized(self) {
+        _hedgeDelay = hedgeDelay;
+    }
+}
+
+- (int)longEdge {
+    @synchronized(self) {
+        return _longEdge;
+    }
+}
+
+- (void)setLongEdge:(int)longEdge {
+    @synchronized(self) {
+        _longEdge = (longEdge > 0 && longEdge < MS_IMG_MIN_SIZE) ? MS_IMG_MIN_SIZE : longEdge;
+    }
+}
+
+- (BOOL)adaptive {
+    @synchronized(self) {
+        return _adaptive;
+    }
+}
+
+- (void)setAdaptive:(BOOL)adaptive {
+    @synchronized(self) {
+        _adaptive = adaptive;
+    }
+}
+
+- (MSApiClientStats)stats {
+    @synchronized(self) {
+        return _stats;
+    }
+}
+
+- (MSResult *)search:(MSImage *)qry error:(NSError **)error {
+    return [self search:qry token:nil error:error];
+}
+
+- (MSResult *)search:(MSImage *)qry token:(MSApiToken *)token error:(NSError **)error {
+    MSResult *result = nil;
+
+#if MS_SDK_REQUIREMENTS
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    NSUInteger cancels;
+    NSTimeInterval budget, hedge;
+    int longEdge;
+    @synchronized(self) {
+        _stats.requests++;
+        cancels = _cancels;
+        budget = _budget;
+        hedge = _hedgeDelay;
+        longEdge = _longEdge;
+    }
+
+    // Resize the query to save bandwidth
+    if (longEdge > 0) {
+        MSImage *small = [qry imageWithLongEdge:longEdge];
+        if ([small image] != NULL) qry = small;
+    }
+    NSUInteger bytes = (NSUInteger) [qry width] * [qry height];
+
+    ms_result_t *res = NULL;
+    ms_errcode ecode = MS_SUCCESS;
+    for (int retries = 0; ; retries++) {
+        uint64_t t = MSTraceNow();
+        ecode = [self race:qry hedge:hedge token:token result:&res];
+        MSTraceRecord(MS_TRACE_API, t);
+        if (!ms_api_is_transient(ecode)) break;
+
+        // Full jitter: spread the retries of concurrent clients
+        NSTimeInterval delay = MS_API_CLIENT_RETRY_DELAY * (1 << retries) * (arc4random_uniform(1001) / 1000.0);
+        if (CFAbsoluteTimeGetCurrent() - start + delay >= budget) break;
+        [NSThread sleepForTimeInterval:delay];
+
+        BOOL cancelled;
+        @synchronized(self) {
+            cancelled = (_cancels != cancels || [token isCancelled]);
+            if (!cancelled) _stats.retries++;
+        }
+        if (cancelled) {
+            ecode = MS_ABORT;
+            break;
+        }
+        MSDLog(@" [API] RETRY #%d AFTER %@", retries + 1, MSErrMsg(ecode));
+    }
+
+    if (ecode == MS_SUCCESS) {
+        if (res != NULL) {
+            result = [[[MSResult alloc] initWithResult:res] autorelease_stub];
+            ms_result_del(res);
+        }
+    }
+    else if (error) {
+        *error = [NSError errorWithDomain:@"moodstocks-sdk" code:ecode userInfo:nil];
+    }
+
+    CFTimeInterval elapsed = CFAbsoluteTimeGetCurrent() - start;
+    @synchronized(self) {
+        if (ecode != MS_SUCCESS) _stats.failures++;
+        _stats.bytes += bytes;
+        _stats.lastBytes = bytes;
+        _stats.lastTime = elapsed;
+        _stats.totalTime += elapsed;
+
+        if (_adaptive && _longEdge > 0) {
+            if (ecode == MS_SLOWCONN || (ecode == MS_SUCCESS && elapsed > MS_API_CLIENT_SLOW_TIME))
+                _longEdge = MAX(MS_IMG_MIN_SIZE, _longEdge * 3 / 4);
+            else if (ecode == MS_SUCCESS && elapsed < MS_API_CLIENT_FAST_TIME)
+                _longEdge = MIN(MS_IMG_MAX_WIDTH, _longEdge * 5 / 4);
+        }
+    }
+    MSDLog(@" [API] %d BYTE(S) IN %.0f MS (%@)", (int) bytes, 1000 * elapsed, MSErrMsg(ecode));
+#endif
+
+    return result;
+}
+
+- (MSResult *)hybridSearch:(MSImage *)qry path:(MSSearchPath *)path error:(NSError **)error {
+    return [self hybridSearch:qry path:path token:nil error:error];
+}
+
+- (MSResult *)hybridSearch:(MSImage *)qry
+                      path:(MSSearchPath *)path
+                     token:(MSApiToken *)token
+                     error:(NSError **)error {
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    MSHybridRace *race = [[MSHybridRace alloc] init];
+
+    // The online search gets its own scope so that an offline match does not
+    // cancel anything else, while it still follows the caller's token
+    MSApiToken *apiToken = [[MSApiToken alloc] init];
+    if (token != nil && ![token addChild:apiToken]) [apiToken cancel];
+
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+        MSResult *result = [_scanner search:qry error:nil];
+        @synchronized(race) {
+            race->local = [result retain_stub];
+            // An offline match makes the online search useless
+            if (result != nil && !race->apiDone) [apiToken cancel];
+        }
+        dispatch_semaphore_signal(race->done);
+    });
+
+    NSError *apiError = nil;
+    MSResult *result = [self search:qry token:apiToken error:&apiError];
+    @synchronized(race) {
+        race->apiDone = YES;
+    }
+    [token removeChild:apiToken];
+    [apiToken release_stub];
+
+    MSSearchPath winner = (result != nil) ? MS_SEARCH_PATH_API : MS_SEARCH_PATH_NONE;
+    if (result == nil) {
+        // The online search missed (or has been cancelled): rely on the offline one
+        dispatch_semaphore_wait(race->done, DISPATCH_TIME_FOREVER);
+        @synchronized(race) {
+            result = [[race->local retain_stub] autorelease_stub];
+        }
+        if (result != nil) {
+            winner = MS_SEARCH_PATH_LOCAL;
+            apiError = nil;
+        }
+    }
+    [race release_stub];
+
+    @synchronized(self) {
+        if (winner == MS_SEARCH_PATH_LOCAL) _stats.localWins++;
+        if (winner == MS_SEARCH_PATH_API) _stats.apiWins++;
+        MSHistogramAdd(&_histograms[winner], CFAbsoluteTimeGetCurrent() - start);
+    }
+
+    if (path) *path = winner;
+    if (apiError != nil && error) *error = apiError;
+    return result;
+}
+
+- (MSHistogram)histogramForPath:(MSSearchPath)path {
+    @synchronized(self) {
+        return _histograms[path];
+    }
+}
+
+- (void)cancelAll {
+    @synchronized(self) {
+        _cancels++;
+        for (MSApiRace *race in _races) {
+            @synchronized(race) {
+                [race cancel];
+            }
+        }
+    }
+}
+
+- (void)drain {
+#if MS_SDK_REQUIREMENTS
+    NSArray *races = nil;
+    @synchronized(self) {
+        // Handles currently in use are released when given back
+        _suspended = YES;
+        _generation++;
+        for (NSUInteger i = 0; i < _idleCount; i++)
+            ms_api_handle_release(_idle[i]);
+        _idleCount = 0;
+        races = [_races allObjects];
+    }
+
+    // Abort the requests in flight (without cancelling their searches, see
+    // `launch:query:`) rather than waiting for the network
+    for (MSApiRace *race in races) {
+        @synchronized(race) {
+            for (int i = 0; i < 2; i++) {
+                if (race->handles[i] != NULL) ms_api_handle_cancel(race->handles[i]);
+            }
+        }
+    }
+    dispatch_group_wait(_leases, DISPATCH_TIME_FOREVER);
+#endif
+}
+
+- (void)resume {
+    @synchronized(self) {
+        _suspended = NO;
+    }
+}
+
+#pragma mark - Private
+
+#if MS_SDK_REQUIREMENTS
+// Send a request, and a hedged one if it takes too long, then wait for the
+// first success (or for both failures)
+- (ms_errcode)race:(MSImage *)qry
+             hedge:(NSTimeInterval)hedge
+             token:(MSApiToken *)token
+            result:(ms_result_t **)result {
+    MSApiRace *race = [[MSApiRace alloc] init];
+    if (token != nil && ![token addRace:race]) {
+        [race release_stub];
+        *result = NULL;
+        return MS_ABORT;
+    }
+    @synchronized(self) {
+        [_races addObject:race];
+    }
+
+    [self launch:race query:qry];
+    BOOL hedged = NO;
+    if (hedge > 0) {
+        dispatch_time_t timeout = dispatch_time(DISPATCH_TIME_NOW, (int64_t) (hedge * NSEC_PER_SEC));
+        if (dispatch_semaphore_wait(race->done, timeout) != 0) {
+            hedged = YES;
+            [self launch:race query:qry];
+            dispatch_semaphore_wait(race->done, DISPATCH_TIME_FOREVER);
+        }
+    }
+    else {
+        dispatch_semaphore_wait(race->done, DISPATCH_TIME_FOREVER);
+    }
+
+    ms_errcode ecode;
+    int winner;
+    @synchronized(race) {
+        ecode = race->ecode;
+        winner = race->winner;
+        *result = race->result;
+        race->result = NULL;
+    }
+
+    [token removeRace:race];
+    @synchronized(self) {
+        [_races removeObject:race];
+        if (hedged) _stats.hedges++;
+        if (winner == 1) _stats.hedgeWins++;
+    }
+    [race release_stub];
+    return ecode;
+}
+
+- (void)launch:(MSApiRace *)race query:(MSImage *)qry {
+    int slot;
+    @synchronized(race) {
+        if (race->finished) return;
+        slot = race->launched++;
+        race->pending++;
+    }
+
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        ms_result_t *res = NULL;
+        NSUInteger generation = 0;
+        ms_errcode ecode = MS_SUCCESS;
+        ms_api_handle_t *handle = [self leaseHandle:&ecode generation:&generation];
+
+        if (handle != NULL) {
+            @synchronized(race) {
+                if (race->cancelled || race->finished)
+                    ecode = MS_ABORT;
+                else
+                    race->handles[slot] = handle;
+            }
+            // The handle is now visible to `drain`, unless it came too late
+            BOOL drained;
+            @synchronized(self) {
+                drained = (generation != _generation);
+            }
+            if (ecode == MS_SUCCESS && !drained)
+                ecode = ms_api_handle_search(handle, [qry image], &res);
+            else if (ecode == MS_SUCCESS)
+                ecode = MS_ABORT;
+            @synchronized(race) {
+                race->handles[slot] = NULL;
+            }
+
+            // A request aborted by `drain` is retried later on
+            if (ecode == MS_ABORT) {
+                @synchronized(self) {
+                    drained = (generation != _generation);
+                }
+                @synchronized(race) {
+                    if (drained && !race->cancelled) ecode = MS_UNAVAIL;
+                }
+            }
+
+            // A handle that went through an error is not trusted anymore
+            if (ecode == MS_SUCCESS)
+                [self returnHandle:handle generation:generation];
+            else
+                ms_api_handle_release(handle);
+            dispatch_group_leave(_leases);
+        }
+
+        @synchronized(race) {
+            race->pending--;
+            if (race->finished) {
+                // Lost the race
+                if (res != NULL) ms_result_del(res);
+            }
+            else if (ecode == MS_SUCCESS || race->pending == 0) {
+                race->finished = YES;
+                race->ecode = ecode;
+                race->result = res;
+                race->winner = (ecode == MS_SUCCESS) ? slot : -1;
+                for (int i = 0; i < 2; i++) {
+                    if (race->handles[i] != NULL) ms_api_handle_cancel(race->handles[i]);
+                }
+                dispatch_semaphore_signal(race->done);
+            }
+            else {
+                // Wait for the other request
+                race->ecode = ecode;
+            }
+        }
+    });
+}
+
+// NOTE: a leased handle is tracked by `_leases` until it is given back (see
+// `launch:query:`) so that `drain` can wait for it: the scanner must not be
+// closed (e.g. swapped) while one of its handles is in use
+- (ms_api_handle_t *)leaseHandle:(ms_errcode *)ecode generation:(NSUInteger *)generation {
+    ms_api_handle_t *handle = NULL;
+    @synchronized(self) {
+        if (_suspended) {
+            // The scanner is being swapped: try again in a moment
+            *ecode = MS_UNAVAIL;
+            return NULL;
+        }
+        dispatch_group_enter(_leases);
+        _stats.attempts++;
+        *generation = _generation;
+        if (_idleCount > 0) {
+            _stats.reuses++;
+            handle = _idle[--_idleCount];
+        }
+    }
+
+    if (handle == NULL) {
+        // Only the creation of the handle needs the scanner, not the request
+        [_scanner lockShared];
+        *ecode = ms_scanner_api_handle([_scanner handle], &handle);
+        [_scanner unlock];
+        if (*ecode != MS_SUCCESS) handle = NULL;
+    }
+    if (handle == NULL) dispatch_group_leave(_leases);
+    return handle;
+}
+
+- (void)returnHandle:(ms_api_handle_t *)handle generation:(NSUInteger)generation {
+    @synchronized(self) {
+        if (generation == _generation && _idleCount < _capacity) {
+            _idle[_idleCount++] = handle;
+            return;
+        }
+    }
+    ms_api_handle_release(handle);
+}
+#endif
+
+@end
@@ -29,7 +29,8 @@
 @interface MSApiSearch : NSOperation {
     MSScanner *_scanner;
     MSImage *_query;
-    ms_api_handle_t *_request;
+    MSApiToken *_token;
+    BOOL _hybrid;
 #if __has_feature(objc_arc_weak)
     id<MSScannerDelegate> __weak _delegate;
 #elif __has_feature(objc_arc)
@@ -41,6 +42,11 @@
 
 - (id)initWithScanner:(MSScanner *)scanner query:(MSImage *)qry;
 
+/**
+ * Race an offline search against the online one (default: NO)
+ */
+@property (nonatomic, assign) BOOL hybrid;
+
 #if __has_feature(objc_arc_weak)
 @property (nonatomic, weak) id<MSScannerDelegate> delegate;
 #elif __has_feature(objc_arc)
@@ -23,24 +23,28 @@
 
 #import "MSAvailability.h"
 #import "MSApiSearch.h"
+#import "MSDebug.h"
 #import "MSObjC.h"
 
 @interface MSApiSearch ()
 - (void)willSearch;
 - (void)didSearchWithResult:(MSResult *)result;
+- (void)didQueueSearch:(MSQueuedQuery *)query;
 - (void)failedToSearchWithError:(NSError *)error;
 @end
 
 @implementation MSApiSearch
 
 @synthesize delegate = _delegate;
+@synthesize hybrid = _hybrid;
 
 - (id)initWithScanner:(MSScanner *)scanner query:(MSImage *)qry {
     self = [super init];
     if (self) {
         _scanner = scanner;
         _query = [qry retain_stub];
-        _request = NULL;
+        _token = [[MSApiToken alloc] init];
+        _hybrid = NO;
         _delegate = nil;
         
     }
@@ -51,6 +55,8 @@
     _scanner = nil;
     [_query release_stub];
     _query = nil;
+    [_token release_stub];
+    _token = nil;
     _delegate = nil;
     
 #if ! __has_feature(objc_arc)
@@ -62,9 +68,8 @@
     NSError *error = [NSError errorWithDomain:@"moodstocks-sdk" code:-1 /* cancel error */ userInfo:nil];
     [self performSelectorOnMainThread:@selector(failedToSearchWithError:) withObject:error waitUntilDone:YES];
     
-#if MS_SDK_REQUIREMENTS
-    if (_request) ms_api_handle_cancel(_request);
-#endif
+    // NOTE: only abort this search, not the other ones of the shared client
+    [_token cancel];
 
     [super cancel];
 }
@@ -83,31 +88,33 @@
     if (![self isCancelled]) {
         [self performSelectorOnMainThread:@selector(willSearch) withObject:nil waitUntilDone:YES];
 
-        ms_result_t *res = NULL;
-        ms_errcode ecode = ms_scanner_api_handle([_scanner handle], &_request);
-        if (ecode == MS_SUCCESS)
-            ecode = ms_api_handle_search(_request, [_query image], &res);
-        
-        if (ecode == MS_SUCCESS) {
-            if (res != NULL) {
-                result = [[[MSResult alloc] initWithResult:res] autorelease_stub];
-                ms_result_del(res);
-            }
+        // Warm handles, retries & hedging are handled by the client
+        if (_hybrid) {
+            MSSearchPath path = MS_SEARCH_PATH_NONE;
+            result = [[_scanner apiClient] hybridSearch:_query path:&path token:_token error:&error];
+            MSDLog(@" [API] HYBRID SEARCH WON BY PATH %d", (int) path);
         }
         else {
-            error = [NSError errorWithDomain:@"moodstocks-sdk" code:ecode userInfo:nil];
-        }
-        
-        if (_request != NULL) {
-            ms_api_handle_release(_request);
-            _request = NULL;
+            result = [[_scanner apiClient] search:_query token:_token error:&error];
         }
     }
 
+    // Keep the query for later instead of throwing it away when offline
+    MSQueuedQuery *queued = nil;
+#if MS_IPHONE_OS_REQUIREMENTS
+    if (![self isCancelled] && error != nil && [error code] == MS_NOCONN) {
+        queued = [[_scanner offlineQueue] push:_query error:nil];
+        if (queued != nil) MSDLog(@" [API] NO CONNECTION: QUERY QUEUED AS %@", [queued identifier]);
+    }
+#endif
+
     if (![self isCancelled]) {
         if (!error) {
             [self performSelectorOnMainThread:@selector(didSearchWithResult:) withObject:result waitUntilDone:YES];
         }
+        else if (queued != nil && [_delegate respondsToSelector:@selector(scanner:didQueueSearch:)]) {
+            [self performSelectorOnMainThread:@selector(didQueueSearch:) withObject:queued waitUntilDone:YES];
+        }
         else {
             [self performSelectorOnMainThread:@selector(failedToSearchWithError:) withObject:error waitUntilDone:YES];
         }
@@ -135,6 +142,12 @@
     }
 }
 
+- (void)didQueueSearch:(MSQueuedQuery *)query {
+    if ([_delegate respondsToSelector:@selector(scanner:didQueueSearch:)]) {
+        [_delegate scanner:_scanner didQueueSearch:query];
+    }
+}
+
 - (void)failedToSearchWithError:(NSError *)error {
     if ([_delegate respondsToSelector:@selector(scanner:failedToSearchWithError:)]) {
         [_delegate scanner:_scanner failedToSearchWithError:error];
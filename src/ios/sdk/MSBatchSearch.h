@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSAvailability.h"
+#import "MSScanner.h"
+
+/**
+ * Offline image search over a batch of query images
+ *
+ * The queries are sharded over `maxConcurrency` threads. Each result is
+ * streamed to the delegate as soon as it is available, then the whole batch
+ * is reported in input order.
+ */
+@interface MSBatchSearch : NSOperation {
+    MSScanner *_scanner;
+    NSArray *_queries;
+    NSUInteger _maxConcurrency;
+    NSTimeInterval _duration;
+#if __has_feature(objc_arc_weak)
+    id<MSScannerDelegate> __weak _delegate;
+#elif __has_feature(objc_arc)
+    id<MSScannerDelegate> __unsafe_unretained _delegate;
+#else
+    id<MSScannerDelegate> _delegate;
+#endif
+}
+
+- (id)initWithScanner:(MSScanner *)scanner queries:(NSArray *)queries;
+
+/**
+ * Number of threads used to search the batch
+ *
+ * Default: number of active processors.
+ */
+@property (nonatomic, assign) NSUInteger maxConcurrency;
+
+/** Time spent searching the batch, in seconds */
+@property (nonatomic, readonly) NSTimeInterval duration;
+
+#if __has_feature(objc_arc_weak)
+@property (nonatomic, weak) id<MSScannerDelegate> delegate;
+#elif __has_feature(objc_arc)
+@property (nonatomic, unsafe_unretained) id<MSScannerDelegate> delegate;
+#else
+@property (nonatomic, assign) id<MSScannerDelegate> delegate;
+#endif
+
+@end
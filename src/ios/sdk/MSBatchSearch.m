@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSBatchSearch.h"
+#import "MSDebug.h"
+#import "MSObjC.h"
+
+@interface MSBatchSearch ()
+- (void)didSearchItem:(NSUInteger)index withResult:(MSResult *)result error:(NSError *)error;
+- (void)didSearchBatchWithResults:(NSArray *)results errors:(NSArray *)errors;
+@end
+
+@implementation MSBatchSearch
+
+@synthesize maxConcurrency = _maxConcurrency;
+@synthesize duration = _duration;
+@synthesize delegate = _delegate;
+
+- (id)initWithScanner:(MSScanner *)scanner queries:(NSArray *)queries {
+    self = [super init];
+    if (self) {
+        _scanner = scanner;
+        _queries = [queries copy];
+        _maxConcurrency = [[NSProcessInfo processInfo] activeProcessorCount];
+        _duration = 0;
+        _delegate = nil;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    _scanner = nil;
+    [_queries release_stub];
+    _queries = nil;
+    _delegate = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (void)main {
+#if __has_feature(objc_arc)
+    @autoreleasepool {
+#else
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+#endif
+
+#if MS_SDK_REQUIREMENTS
+    NSUInteger count = [_queries count];
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray *errors = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        [results addObject:[NSNull null]];
+        [errors addObject:[NSNull null]];
+    }
+
+    size_t shards = (_maxConcurrency > 0) ? _maxConcurrency : 1;
+    if (shards > count) shards = count;
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+
+    // Each shard handles every `shards`-th query
+    dispatch_apply(shards, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t shard) {
+        for (NSUInteger i = shard; i < count && ![self isCancelled]; i += shards) {
+#if __has_feature(objc_arc)
+            @autoreleasepool {
+#else
+            NSAutoreleasePool *itemPool = [[NSAutoreleasePool alloc] init];
+#endif
+            NSError *err = nil;
+            MSResult *result = [_scanner search:[_queries objectAtIndex:i] error:&err];
+            if (err != nil && [err code] == MS_EMPTY) err = nil;
+
+            @synchronized(results) {
+                if (result != nil) [results replaceObjectAtIndex:i withObject:result];
+                if (err != nil) [errors replaceObjectAtIndex:i withObject:err];
+            }
+
+            [self didSearchItem:i withResult:result error:err];
+#if __has_feature(objc_arc)
+            }
+#else
+            [itemPool release];
+#endif
+        }
+    });
+
+    _duration = CFAbsoluteTimeGetCurrent() - start;
+    MSDLog(@" [MOODSTOCKS SDK] BATCH SEARCH: %d IMAGE(S) IN %.3fs (%.1f IMAGE(S)/S, %d THREAD(S))",
+           (int) count, _duration, (_duration > 0) ? count / _duration : 0, (int) shards);
+
+    if (![self isCancelled]) {
+        [self didSearchBatchWithResults:results errors:errors];
+    }
+#endif
+
+#if __has_feature(objc_arc)
+    } /* end of @autoreleasepool block */
+#else
+    [pool release];
+#endif
+}
+
+#pragma mark - Private
+
+- (void)didSearchItem:(NSUInteger)index withResult:(MSResult *)result error:(NSError *)error {
+    if (![_delegate respondsToSelector:@selector(scanner:didSearchBatchItem:withResult:error:)]) return;
+
+    [result retain_stub];
+    [error retain_stub];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [_delegate scanner:_scanner didSearchBatchItem:index withResult:result error:error];
+        [result release_stub];
+        [error release_stub];
+    });
+}
+
+- (void)didSearchBatchWithResults:(NSArray *)results errors:(NSArray *)errors {
+    if (![_delegate respondsToSelector:@selector(scanner:didSearchBatchWithResults:errors:)]) return;
+
+    dispatch_sync(dispatch_get_main_queue(), ^{
+        [_delegate scanner:_scanner didSearchBatchWithResults:results errors:errors];
+    });
+}
+
+@end
@@ -126,10 +126,19 @@ static void ms_capturesession_cleanup(void *s) {
 #endif
     dispatch_set_finalizer_f(videoDataOutputQueue, ms_capturesession_cleanup);
 
-    NSDictionary *settings = [NSDictionary dictionaryWithObject:[NSNumber numberWithInt:kCVPixelFormatType_32BGRA]
+    _videoOutput = [[AVCaptureVideoDataOutput alloc] init];
+
+    // Prefer bi-planar YUV frames: the luma plane is then handed over as is
+    // to the SDK (8-bit gray), which avoids a per-frame BGRA to gray conversion
+    OSType pixelFormat = kCVPixelFormatType_32BGRA;
+    NSNumber *yuv = [NSNumber numberWithInt:kCVPixelFormatType_420YpCbCr8BiPlanarFullRange];
+    if ([_videoOutput respondsToSelector:@selector(availableVideoCVPixelFormatTypes)] &&
+        [[_videoOutput availableVideoCVPixelFormatTypes] containsObject:yuv])
+        pixelFormat = kCVPixelFormatType_420YpCbCr8BiPlanarFullRange;
+
+    NSDictionary *settings = [NSDictionary dictionaryWithObject:[NSNumber numberWithInt:pixelFormat]
                                                          forKey:(id)kCVPixelBufferPixelFormatTypeKey];
 
-    _videoOutput = [[AVCaptureVideoDataOutput alloc] init];
     [_videoOutput setVideoSettings:settings];
     [_videoOutput setAlwaysDiscardsLateVideoFrames:YES];
     [_videoOutput setSampleBufferDelegate:self queue:videoDataOutputQueue];
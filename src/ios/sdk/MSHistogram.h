@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+
+/**
+ * Latency histograms
+ * --
+ * Durations are counted into power-of-two buckets of microseconds: bucket `i`
+ * holds the durations within [2^i, 2^(i+1)) us, the first one also holds the
+ * shorter durations and the last one the longer ones (i.e. above ~16 s).
+ *
+ * Histograms are plain structures: the caller is responsible for locking.
+ */
+
+/** Number of buckets */
+#define MS_HISTOGRAM_BUCKETS 24
+
+typedef struct {
+    uint32_t counts[MS_HISTOGRAM_BUCKETS];
+    uint32_t count;         /* number of recorded durations */
+    double sum;             /* cumulated duration in seconds */
+    double max;             /* longest duration in seconds */
+} MSHistogram;
+
+/**
+ * Record a duration in seconds
+ */
+void MSHistogramAdd(MSHistogram *h, double seconds);
+
+/**
+ * Duration in seconds below which lies the given fraction `p` (within [0, 1])
+ * of the recorded durations, e.g. 0.5 for the median
+ *
+ * This is the upper bound of the matching bucket (capped by the longest
+ * duration), or 0 if the histogram is empty.
+ */
+double MSHistogramPercentile(const MSHistogram *h, double p);
+
+/**
+ * Mean duration in seconds (0 if the histogram is empty)
+ */
+double MSHistogramMean(const MSHistogram *h);
@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSHistogram.h"
+
+void MSHistogramAdd(MSHistogram *h, double seconds) {
+    uint64_t us = (seconds > 0) ? (uint64_t) (seconds * 1e6) : 0;
+    int bucket = 0;
+    while (us > 1 && bucket < MS_HISTOGRAM_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    h->counts[bucket]++;
+    h->count++;
+    h->sum += seconds;
+    if (seconds > h->max) h->max = seconds;
+}
+
+double MSHistogramPercentile(const MSHistogram *h, double p) {
+    if (h->count == 0) return 0;
+    uint64_t rank = (uint64_t) (p * h->count + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < MS_HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            double upper = (double) (1ULL << (i + 1)) / 1e6;
+            return (upper < h->max) ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+double MSHistogramMean(const MSHistogram *h) {
+    return (h->count > 0) ? h->sum / h->count : 0;
+}
@@ -0,0 +1,95 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#include <stdint.h>
+
+/**
+ * Read-only index of the image identifiers recorded into the database
+ *
+ * It is a sidecar file (`ms.db.idx`) written after each synchronization and
+ * memory-mapped when the scanner is opened, so that counting or listing the
+ * identifiers does not require to load all of them with `ms_scanner_info`.
+ *
+ * File layout (host byte order):
+ * - a header with a checksum and the size / modification date of the database
+ *   file it was built from (an index that does not match is ignored),
+ * - one checksum per page of the data section,
+ * - the data section: `count` 32-bit offsets followed by the identifiers as
+ *   sorted NUL-terminated strings.
+ *
+ * Opening only checks the header and the page checksums table. The data pages
+ * are checked lazily the first time they are read: an index found corrupt is
+ * flagged as such (see `corrupt`) so that it can be rebuilt.
+ *
+ * This class is thread safe.
+ */
+@interface MSIdIndex : NSObject {
+    void *_map;
+    size_t _mapSize;
+    const uint32_t *_sums;
+    const uint8_t *_data;
+    uint64_t _dataSize;
+    uint32_t _count;
+    uint32_t _pageSize;
+    volatile uint8_t *_pages;
+    volatile BOOL _corrupt;
+}
+
+/** Number of identifiers */
+@property (nonatomic, readonly) NSUInteger count;
+/** Flag indicating whether a corrupt page has been found */
+@property (nonatomic, readonly, getter = isCorrupt) BOOL corrupt;
+
+/**
+ * Write the index of the given identifiers for the database file at `dbPath`
+ *
+ * `ids` is sorted in place. The file is written next to `path` then renamed.
+ */
++ (BOOL)writeIds:(char **)ids count:(int)count forDatabase:(NSString *)dbPath toPath:(NSString *)path;
+
+/**
+ * Map the index stored at `path`
+ *
+ * Returns `nil` if there is no valid index for the database file at `dbPath`.
+ */
+- (id)initWithPath:(NSString *)path database:(NSString *)dbPath;
+
+/**
+ * Get the identifier at the given position (in lexicographic order)
+ *
+ * The returned string lives as long as the index. Returns NULL if the index is
+ * out of bounds or if the identifier lies on a corrupt page.
+ */
+- (const char *)idAtIndex:(NSUInteger)index;
+
+/**
+ * Position of the first identifier greater than or equal to `prefix`, i.e. the
+ * first one starting with `prefix` if any
+ *
+ * Returns `count` if there is none, or `NSNotFound` if a corrupt page was hit.
+ */
+- (NSUInteger)lowerBound:(const char *)prefix;
+
+@end
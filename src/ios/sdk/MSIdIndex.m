@@ -0,0 +1,291 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSIdIndex.h"
+#import "MSDebug.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define MS_ID_INDEX_MAGIC   0x5849534d /* "MSIX" */
+#define MS_ID_INDEX_VERSION 1
+/** Size in bytes of a checksummed page of the data section */
+#define MS_ID_INDEX_PAGE    4096
+
+/** Page states */
+enum {
+    MS_ID_INDEX_PAGE_UNKNOWN = 0,
+    MS_ID_INDEX_PAGE_OK,
+    MS_ID_INDEX_PAGE_BAD
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;         /* number of identifiers */
+    uint32_t pageSize;      /* size in bytes of a checksummed page */
+    uint64_t dataSize;      /* size in bytes of the data section */
+    uint64_t dbSize;        /* size in bytes of the indexed database file */
+    int64_t dbMtime;        /* modification date of the indexed database file */
+    uint32_t sumsSum;       /* checksum of the page checksums table */
+    uint32_t headerSum;     /* checksum of the fields above */
+} ms_id_index_header;
+
+// FNV-1a
+static uint32_t ms_id_index_sum(const void *buf, size_t len) {
+    const uint8_t *p = (const uint8_t *) buf;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int ms_id_index_cmp(const void *a, const void *b) {
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static BOOL ms_id_index_stat(NSString *dbPath, uint64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat([dbPath fileSystemRepresentation], &st) != 0) return NO;
+    *size = (uint64_t) st.st_size;
+    *mtime = (int64_t) st.st_mtime;
+    return YES;
+}
+
+@interface MSIdIndex ()
+- (BOOL)checkRange:(uint64_t)offset length:(uint64_t)length;
+@end
+
+@implementation MSIdIndex
+
+@dynamic count;
+@dynamic corrupt;
+
++ (BOOL)writeIds:(char **)ids count:(int)count forDatabase:(NSString *)dbPath toPath:(NSString *)path {
+    ms_id_index_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if (!ms_id_index_stat(dbPath, &hdr.dbSize, &hdr.dbMtime)) return NO;
+    if (count > 0) qsort(ids, count, sizeof(char *), ms_id_index_cmp);
+
+    hdr.magic = MS_ID_INDEX_MAGIC;
+    hdr.version = MS_ID_INDEX_VERSION;
+    hdr.count = (uint32_t) count;
+    hdr.pageSize = MS_ID_INDEX_PAGE;
+    hdr.dataSize = (uint64_t) count * sizeof(uint32_t);
+    for (int i = 0; i < count; i++)
+        hdr.dataSize += strlen(ids[i]) + 1;
+    if (hdr.dataSize > UINT32_MAX) return NO;
+
+    // Data section
+    uint8_t *data = (uint8_t *) malloc(hdr.dataSize > 0 ? hdr.dataSize : 1);
+    if (data == NULL) return NO;
+    uint32_t *offsets = (uint32_t *) data;
+    uint32_t off = (uint32_t) count * sizeof(uint32_t);
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(ids[i]) + 1;
+        offsets[i] = off;
+        memcpy(data + off, ids[i], len);
+        off += len;
+    }
+
+    // Page checksums
+    uint64_t npages = (hdr.dataSize + MS_ID_INDEX_PAGE - 1) / MS_ID_INDEX_PAGE;
+    uint32_t *sums = (uint32_t *) malloc((npages > 0 ? npages : 1) * sizeof(uint32_t));
+    if (sums == NULL) {
+        free(data);
+        return NO;
+    }
+    for (uint64_t p = 0; p < npages; p++) {
+        uint64_t start = p * MS_ID_INDEX_PAGE;
+        uint64_t len = (hdr.dataSize - start < MS_ID_INDEX_PAGE) ? hdr.dataSize - start : MS_ID_INDEX_PAGE;
+        sums[p] = ms_id_index_sum(data + start, len);
+    }
+    hdr.sumsSum = ms_id_index_sum(sums, npages * sizeof(uint32_t));
+    hdr.headerSum = ms_id_index_sum(&hdr, offsetof(ms_id_index_header, headerSum));
+
+    // Write to a temporary file then rename so that readers never see a partial index
+    NSString *tmpPath = [path stringByAppendingString:@".tmp"];
+    FILE *f = fopen([tmpPath fileSystemRepresentation], "wb");
+    BOOL ok = (f != NULL);
+    if (ok) {
+        ok = (fwrite(&hdr, sizeof(hdr), 1, f) == 1);
+        if (ok && npages > 0) ok = (fwrite(sums, npages * sizeof(uint32_t), 1, f) == 1);
+        if (ok && hdr.dataSize > 0) ok = (fwrite(data, hdr.dataSize, 1, f) == 1);
+        ok = (fclose(f) == 0) && ok;
+    }
+    if (ok) ok = (rename([tmpPath fileSystemRepresentation], [path fileSystemRepresentation]) == 0);
+    if (!ok) unlink([tmpPath fileSystemRepresentation]);
+
+    free(sums);
+    free(data);
+    return ok;
+}
+
+- (id)initWithPath:(NSString *)path database:(NSString *)dbPath {
+    self = [super init];
+    if (self) {
+        _map = NULL;
+        _pages = NULL;
+        _corrupt = NO;
+
+        int fd = open([path fileSystemRepresentation], O_RDONLY);
+        struct stat st;
+        if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(ms_id_index_header)) {
+            _mapSize = (size_t) st.st_size;
+            _map = mmap(NULL, _mapSize, PROT_READ, MAP_SHARED, fd, 0);
+            if (_map == MAP_FAILED) _map = NULL;
+        }
+        if (fd >= 0) close(fd);
+
+        // Validate the header and the page checksums table
+        BOOL valid = (_map != NULL);
+        const ms_id_index_header *hdr = (const ms_id_index_header *) _map;
+        uint64_t npages = 0;
+        if (valid) {
+            valid = (hdr->magic == MS_ID_INDEX_MAGIC &&
+                     hdr->version == MS_ID_INDEX_VERSION &&
+                     hdr->pageSize > 0 &&
+                     hdr->headerSum == ms_id_index_sum(hdr, offsetof(ms_id_index_header, headerSum)));
+        }
+        if (valid) {
+            npages = (hdr->dataSize + hdr->pageSize - 1) / hdr->pageSize;
+            valid = (sizeof(*hdr) + npages * sizeof(uint32_t) + hdr->dataSize == _mapSize &&
+                     (uint64_t) hdr->count * sizeof(uint32_t) <= hdr->dataSize);
+        }
+        if (valid) {
+            _sums = (const uint32_t *) ((const uint8_t *) _map + sizeof(*hdr));
+            valid = (hdr->sumsSum == ms_id_index_sum(_sums, npages * sizeof(uint32_t)));
+        }
+        if (valid) {
+            // Ignore an index built for another version of the database
+            uint64_t dbSize;
+            int64_t dbMtime;
+            valid = (ms_id_index_stat(dbPath, &dbSize, &dbMtime) &&
+                     dbSize == hdr->dbSize &&
+                     dbMtime == hdr->dbMtime);
+        }
+
+        if (!valid) {
+            if (_map != NULL) munmap(_map, _mapSize);
+            _map = NULL;
+#if ! __has_feature(objc_arc)
+            [self release];
+#endif
+            return nil;
+        }
+
+        _count = hdr->count;
+        _pageSize = hdr->pageSize;
+        _dataSize = hdr->dataSize;
+        _data = (const uint8_t *) (_sums + npages);
+        _pages = (volatile uint8_t *) calloc(npages > 0 ? npages : 1, sizeof(uint8_t));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_map != NULL) munmap(_map, _mapSize);
+    _map = NULL;
+    free((void *) _pages);
+    _pages = NULL;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (NSUInteger)count {
+    return (NSUInteger) _count;
+}
+
+- (BOOL)isCorrupt {
+    return _corrupt;
+}
+
+- (const char *)idAtIndex:(NSUInteger)index {
+    if (index >= _count) return NULL;
+
+    uint64_t entry = (uint64_t) index * sizeof(uint32_t);
+    if (![self checkRange:entry length:sizeof(uint32_t)]) return NULL;
+    uint32_t off = *(const uint32_t *) (_data + entry);
+
+    // The identifier must be NUL-terminated within the data section
+    if (off >= _dataSize || ![self checkRange:off length:1]) return NULL;
+    const char *str = (const char *) (_data + off);
+    size_t len = strnlen(str, (size_t) (_dataSize - off));
+    if (len == _dataSize - off || ![self checkRange:off length:len + 1]) {
+        _corrupt = YES;
+        return NULL;
+    }
+    return str;
+}
+
+- (NSUInteger)lowerBound:(const char *)prefix {
+    NSUInteger lo = 0;
+    NSUInteger hi = _count;
+    while (lo < hi) {
+        NSUInteger mid = lo + (hi - lo) / 2;
+        const char *str = [self idAtIndex:mid];
+        if (str == NULL) return NSNotFound;
+        if (strcmp(str, prefix) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+#pragma mark - Private
+
+// Check the pages covering the given range of the data section
+//
+// NOTE: page states are only ever set to the same value by concurrent callers
+- (BOOL)checkRange:(uint64_t)offset length:(uint64_t)length {
+    if (length == 0) return YES;
+    uint64_t first = offset / _pageSize;
+    uint64_t last = (offset + length - 1) / _pageSize;
+    for (uint64_t p = first; p <= last; p++) {
+        if (_pages[p] == MS_ID_INDEX_PAGE_UNKNOWN) {
+            uint64_t start = p * _pageSize;
+            uint64_t len = (_dataSize - start < _pageSize) ? _dataSize - start : _pageSize;
+            BOOL ok = (ms_id_index_sum(_data + start, (size_t) len) == _sums[p]);
+            _pages[p] = ok ? MS_ID_INDEX_PAGE_OK : MS_ID_INDEX_PAGE_BAD;
+            if (!ok) MSDLog(@" [ID INDEX] CORRUPT PAGE %d", (int) p);
+        }
+        if (_pages[p] == MS_ID_INDEX_PAGE_BAD) {
+            _corrupt = YES;
+            return NO;
+        }
+    }
+    return YES;
+}
+
+@end
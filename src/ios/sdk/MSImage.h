@@ -27,22 +27,116 @@
   #import <AVFoundation/AVFoundation.h>
 #endif
 
-#include "moodstocks_sdk.h"
+#import "MSImageProc.h"
 
 /**
  * Wrapper around the Moodstocks SDK image data structure
  */
+/** Thumbnail width in pixels (see `thumbnail`) */
+#define MS_THUMB_WIDTH  32
+/** Thumbnail height in pixels (see `thumbnail`) */
+#define MS_THUMB_HEIGHT 18
+/** Thumbnail size in bytes */
+#define MS_THUMB_SIZE   (MS_THUMB_WIDTH * MS_THUMB_HEIGHT)
+
 @interface MSImage : NSObject {
     ms_img_t *_img;
+    ms_ori_t _ori;
+    uint8_t _thumb[MS_THUMB_SIZE];
+    BOOL _hasThumb;
+    int _width;
+    int _height;
+#if MS_IPHONE_OS_REQUIREMENTS
+    CVPixelBufferRef _pixelBuffer;
+    uint8_t *_gray;
+    int _grayWidth;
+    int _grayHeight;
+#endif
 }
 
 @property (readonly, nonatomic) ms_img_t *image;
 
+/** Width in pixels of `image` (0 if there is none) */
+@property (readonly, nonatomic) int width;
+/** Height in pixels of `image` (0 if there is none) */
+@property (readonly, nonatomic) int height;
+
+/** Orientation of the pixels */
+@property (readonly, nonatomic) ms_ori_t orientation;
+
+/**
+ * Tiny 8-bit gray version of the image (`MS_THUMB_WIDTH` x `MS_THUMB_HEIGHT`
+ * pixels, in the orientation of the input pixels)
+ *
+ * It is computed when the image is created from pixels and is meant for cheap
+ * frame-to-frame comparisons. This is NULL if the image has no pixels.
+ */
+@property (readonly, nonatomic) const uint8_t *thumbnail;
+
 - (id)init;
+/**
+ * Create an image from a plane of pixels
+ *
+ * The pixels are only read during this call: the plane can be released
+ * as soon as it returns.
+ */
+- (id)initWithPlane:(const MSPlane *)plane orientation:(ms_ori_t)orientation;
 #if MS_IPHONE_OS_REQUIREMENTS
 - (id)initWithBuffer:(CMSampleBufferRef)buf;
+/**
+ * Create an image from a camera frame
+ *
+ * The frame is released as soon as the image is built: a gray copy of it is
+ * kept instead for the methods below, so that long-lived images (e.g. online
+ * queries) do not hold buffers of the camera pool.
+ */
 - (id)initWithBuffer:(CMSampleBufferRef)buf
          orientation:(AVCaptureVideoOrientation)orientation;
+
+/**
+ * Same as `initWithBuffer:orientation:` except that `keepFrame` retains the
+ * camera frame itself instead of copying it
+ *
+ * This is only meant for images scanned right away (see `MSScanEngine`): the
+ * frame returns to the camera pool when the image is released.
+ */
+- (id)initWithBuffer:(CMSampleBufferRef)buf
+         orientation:(AVCaptureVideoOrientation)orientation
+           keepFrame:(BOOL)keepFrame;
+
+/**
+ * Create a new image out of a region of the camera frame this image has been
+ * created from (or of its gray copy), e.g. to decode barcodes over a smaller area
+ *
+ * `region` is expressed in normalized coordinates (i.e. within [0, 1]) relative
+ * to the camera frame as delivered by the sensor (i.e. before orientation is
+ * applied). `levels` specifies how many times the region is downscaled by 2.
+ *
+ * No pixel is copied unless the region has to be downscaled.
+ *
+ * Returns nil if the image has not been created from a camera frame, or if
+ * the resulting image would be too small for the SDK (see `ms_img_new`).
+ */
+- (MSImage *)imageWithRegion:(CGRect)region levels:(int)levels;
+
+/**
+ * Create a gray copy of the camera frame this image has been created from,
+ * resized so that its largest dimension is `longEdge` pixels (or the SDK
+ * minimum if smaller), e.g. to save bandwidth when uploading it
+ *
+ * Returns the image itself if it is already small enough, or nil if it has
+ * not been created from a camera frame.
+ */
+- (MSImage *)imageWithLongEdge:(int)longEdge;
+
+/**
+ * Same as `imageWithLongEdge:` except that the raw 8-bit gray pixels (tightly
+ * packed rows, in the orientation of the camera frame) are returned instead,
+ * e.g. to persist the query on disk
+ *
+ * Returns nil if the image has not been created from a camera frame.
+ */
+- (NSData *)grayDataWithLongEdge:(int)longEdge width:(int *)width height:(int *)height;
 #endif
 
 @end
@@ -22,14 +22,32 @@
  */
 
 #import "MSImage.h"
+#import "MSImageProc.h"
+#import "MSImagePool.h"
 #import "MSObjC.h"
 
+#include <stdlib.h>
+
 #if MS_IPHONE_OS_REQUIREMENTS
+/**
+ * Describes the pixels of a *locked* camera frame buffer as a plane
+ *
+ * For bi-planar YUV buffers (i.e. `kCVPixelFormatType_420YpCbCr8BiPlanar*`)
+ * the plane points directly to the luma (Y) plane with a `MS_PIX_FMT_GRAY8`
+ * format, so that no color conversion nor copy is required. 32-bit BGRA
+ * buffers are described as `MS_PIX_FMT_RGB32`.
+ *
+ * Returns NO if the pixel format is not supported
+ */
+BOOL MSPlaneFromPixelBuffer(CVPixelBufferRef buf, MSPlane *plane);
+
 /**
  * Creates an image with Moodstocks format from a camera frame buffer
  *
- * The pixel format *must* be 32-bit BGRA (i.e `kCVPixelFormatType_32BGRA`)
- * otherwise the method returns a NULL pointer
+ * The pixel format *must* be either 32-bit BGRA (i.e `kCVPixelFormatType_32BGRA`)
+ * or bi-planar YUV 4:2:0 (i.e. `kCVPixelFormatType_420YpCbCr8BiPlanarFullRange`
+ * or `kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange`) otherwise the method
+ * returns a NULL pointer
  *
  * The caller must manage deletion
  */
@@ -44,43 +62,329 @@ ms_img_t *MSCreateImageFromSampleBuffer(CMSampleBufferRef sbuf);
 ms_img_t *MSCreateImageFromSampleBuffer2(CMSampleBufferRef sbuf, AVCaptureVideoOrientation orientation);
 #endif
 
+#if MS_SDK_REQUIREMENTS
+/**
+ * Same as `ms_img_new` except that planes larger than what the SDK accepts
+ * are first converted to gray and downscaled to the supported size
+ */
+static ms_errcode ms_img_new_from_plane(const MSPlane *plane, ms_ori_t ori, ms_img_t **img) {
+    int levels = MSGrayDownscaleLevels(plane->width, plane->height);
+    if (levels <= 0) {
+        return ms_img_new(plane->data, plane->width, plane->height, plane->bpr,
+                          plane->format, ori, img);
+    }
+
+    int w = plane->width;
+    int h = plane->height;
+    MSImagePool *pool = [MSImagePool sharedPool];
+    uint8_t *gray = (uint8_t *) [pool leaseBuffer:w * h];
+    if (gray == NULL) return MS_ERROR;
+
+    MSGrayFromPlane(plane, gray, w);
+    for (int i = 0; i < levels; i++) {
+        MSGrayDownscale2x(gray, w, h, w, gray, w / 2);
+        w /= 2;
+        h /= 2;
+    }
+
+    ms_errcode ecode = ms_img_new(gray, w, h, w, MS_PIX_FMT_GRAY8, ori, img);
+    [pool returnBuffer:gray];
+    return ecode;
+}
+#endif
+
+#if MS_IPHONE_OS_REQUIREMENTS
+/**
+ * Maps a video orientation to the "real" orientation of a frame
+ */
+static ms_ori_t ms_ori_from_video_orientation(AVCaptureVideoOrientation orientation) {
+    switch (orientation) {
+        case AVCaptureVideoOrientationPortrait:
+            return MS_LEFT_BOTTOM_ORI;
+            
+        case AVCaptureVideoOrientationLandscapeRight:
+            return MS_TOP_LEFT_ORI;
+            
+        case AVCaptureVideoOrientationLandscapeLeft:
+            return MS_BOTTOM_RIGHT_ORI;
+            
+        case AVCaptureVideoOrientationPortraitUpsideDown:
+            return MS_RIGHT_TOP_ORI;
+            
+        default:
+            return MS_UNDEFINED_ORI;
+    }
+}
+#endif
+
+@interface MSImage ()
+- (void)setupWithPlane:(const MSPlane *)plane orientation:(ms_ori_t)orientation;
+#if MS_IPHONE_OS_REQUIREMENTS
+- (BOOL)lockFrame:(MSPlane *)plane;
+- (void)unlockFrame;
+- (uint8_t *)leaseGrayWithLongEdge:(int)longEdge width:(int *)width height:(int *)height;
+#endif
+@end
+
 @implementation MSImage
 
 @synthesize image = _img;
+@synthesize width = _width;
+@synthesize height = _height;
+@synthesize orientation = _ori;
 
 - (id)init {
     self = [super init];
     if (self) {
         _img = NULL;
+        _ori = MS_UNDEFINED_ORI;
+        _hasThumb = NO;
+        _width = 0;
+        _height = 0;
+#if MS_IPHONE_OS_REQUIREMENTS
+        _pixelBuffer = NULL;
+        _gray = NULL;
+        _grayWidth = 0;
+        _grayHeight = 0;
+#endif
     }
     return self;
 }
 
-#if MS_IPHONE_OS_REQUIREMENTS
-- (id)initWithBuffer:(CMSampleBufferRef)buf {
+- (id)initWithPlane:(const MSPlane *)plane orientation:(ms_ori_t)orientation {
     self = [self init];
     if (self) {
-        _img = MSCreateImageFromSampleBuffer(buf);
+        [self setupWithPlane:plane orientation:orientation];
     }
     return self;
 }
 
+#if MS_IPHONE_OS_REQUIREMENTS
+- (id)initWithBuffer:(CMSampleBufferRef)buf {
+    return [self initWithBuffer:buf orientation:-1];
+}
+
 - (id)initWithBuffer:(CMSampleBufferRef)buf
          orientation:(AVCaptureVideoOrientation)orientation {
+    return [self initWithBuffer:buf orientation:orientation keepFrame:NO];
+}
+
+- (id)initWithBuffer:(CMSampleBufferRef)buf
+         orientation:(AVCaptureVideoOrientation)orientation
+           keepFrame:(BOOL)keepFrame {
     self = [self init];
     if (self) {
-        _img = MSCreateImageFromSampleBuffer2(buf, orientation);
+        CVImageBufferRef imageBuffer = CMSampleBufferGetImageBuffer(buf);
+        CVPixelBufferLockBaseAddress(imageBuffer, kCVPixelBufferLock_ReadOnly);
+        
+        MSPlane plane;
+        if (MSPlaneFromPixelBuffer(imageBuffer, &plane)) {
+            [self setupWithPlane:&plane orientation:ms_ori_from_video_orientation(orientation)];
+            // Keep the frame around so that regions can be extracted later on,
+            // or a gray copy of it so that the camera gets its buffer back
+            if (keepFrame) {
+                _pixelBuffer = CVPixelBufferRetain(imageBuffer);
+            }
+            else {
+                _gray = (uint8_t *) malloc((size_t) plane.width * plane.height);
+                if (_gray != NULL) {
+                    MSGrayFromPlane(&plane, _gray, plane.width);
+                    _grayWidth = plane.width;
+                    _grayHeight = plane.height;
+                }
+            }
+        }
+        
+        CVPixelBufferUnlockBaseAddress(imageBuffer, kCVPixelBufferLock_ReadOnly);
     }
     return self;
 }
+
+- (MSImage *)imageWithRegion:(CGRect)region levels:(int)levels {
+    region = CGRectIntersection(region, CGRectMake(0, 0, 1, 1));
+    if (CGRectIsEmpty(region)) return nil;
+    if (levels < 0) levels = 0;
+
+    MSImage *img = nil;
+    MSPlane plane;
+    if ([self lockFrame:&plane]) {
+        int x0 = (int) (CGRectGetMinX(region) * plane.width);
+        int y0 = (int) (CGRectGetMinY(region) * plane.height);
+        int x1 = (int) (CGRectGetMaxX(region) * plane.width);
+        int y1 = (int) (CGRectGetMaxY(region) * plane.height);
+        int w = (x1 - x0) >> levels;
+        int h = (y1 - y0) >> levels;
+
+        if ((w > h ? w : h) >= MS_IMG_MIN_SIZE) {
+            // Cropping is a matter of pointer arithmetic
+            MSPlane crop = plane;
+            int bpp = (plane.format == MS_PIX_FMT_RGB32) ? 4 : 1;
+            crop.data = (const uint8_t *) plane.data + y0 * plane.bpr + x0 * bpp;
+            crop.width = x1 - x0;
+            crop.height = y1 - y0;
+
+            if (levels == 0) {
+                img = [[[MSImage alloc] initWithPlane:&crop orientation:_ori] autorelease_stub];
+            }
+            else {
+                MSImagePool *pool = [MSImagePool sharedPool];
+                uint8_t *gray = (uint8_t *) [pool leaseBuffer:crop.width * crop.height];
+                if (gray != NULL) {
+                    MSGrayFromPlane(&crop, gray, crop.width);
+                    int gw = crop.width;
+                    int gh = crop.height;
+                    for (int i = 0; i < levels; i++) {
+                        MSGrayDownscale2x(gray, gw, gh, gw, gray, gw / 2);
+                        gw /= 2;
+                        gh /= 2;
+                    }
+                    MSPlane scaled = { gray, gw, gh, gw, MS_PIX_FMT_GRAY8 };
+                    img = [[[MSImage alloc] initWithPlane:&scaled orientation:_ori] autorelease_stub];
+                    [pool returnBuffer:gray];
+                }
+            }
+        }
+        [self unlockFrame];
+    }
+
+    return img;
+}
+
+- (MSImage *)imageWithLongEdge:(int)longEdge {
+    if (longEdge < MS_IMG_MIN_SIZE) longEdge = MS_IMG_MIN_SIZE;
+    if (_img != NULL && (_width > _height ? _width : _height) <= longEdge)
+        return [[self retain_stub] autorelease_stub];
+
+    int w = 0, h = 0;
+    uint8_t *gray = [self leaseGrayWithLongEdge:longEdge width:&w height:&h];
+    if (gray == NULL) return nil;
+
+    MSPlane scaled = { gray, w, h, w, MS_PIX_FMT_GRAY8 };
+    MSImage *img = [[[MSImage alloc] initWithPlane:&scaled orientation:_ori] autorelease_stub];
+    [[MSImagePool sharedPool] returnBuffer:gray];
+    return img;
+}
+
+- (NSData *)grayDataWithLongEdge:(int)longEdge width:(int *)width height:(int *)height {
+    if (longEdge < MS_IMG_MIN_SIZE) longEdge = MS_IMG_MIN_SIZE;
+
+    int w = 0, h = 0;
+    uint8_t *gray = [self leaseGrayWithLongEdge:longEdge width:&w height:&h];
+    if (gray == NULL) return nil;
+
+    NSData *data = [NSData dataWithBytes:gray length:w * h];
+    [[MSImagePool sharedPool] returnBuffer:gray];
+    if (width != NULL) *width = w;
+    if (height != NULL) *height = h;
+    return data;
+}
+
+/**
+ * Convert the camera frame to gray and resize it so that its largest dimension
+ * is at most `longEdge` pixels
+ *
+ * The returned buffer is leased from the shared pool: the caller must return it.
+ */
+- (uint8_t *)leaseGrayWithLongEdge:(int)longEdge width:(int *)width height:(int *)height {
+    MSPlane plane;
+    if (![self lockFrame:&plane]) return NULL;
+
+    MSImagePool *pool = [MSImagePool sharedPool];
+    uint8_t *gray = (uint8_t *) [pool leaseBuffer:plane.width * plane.height];
+
+    if (gray != NULL) {
+        MSGrayFromPlane(&plane, gray, plane.width);
+        int w = plane.width;
+        int h = plane.height;
+
+        // Halve the image as long as possible, then resize to the exact size
+        while ((w > h ? w : h) >= 2 * longEdge) {
+            MSGrayDownscale2x(gray, w, h, w, gray, w / 2);
+            w /= 2;
+            h /= 2;
+        }
+        int dw = (w >= h) ? longEdge : (int) (((int64_t) w * longEdge) / h);
+        int dh = (w >= h) ? (int) (((int64_t) h * longEdge) / w) : longEdge;
+        if (dw < w || dh < h) {
+            uint8_t *resized = (uint8_t *) [pool leaseBuffer:dw * dh];
+            if (resized != NULL) {
+                MSGrayResize(gray, w, h, w, resized, dw, dh, dw);
+                w = dw;
+                h = dh;
+            }
+            [pool returnBuffer:gray];
+            gray = resized;
+        }
+        *width = w;
+        *height = h;
+    }
+
+    [self unlockFrame];
+    return gray;
+}
+
+/**
+ * Describe the camera frame (or its gray copy) this image has been created from
+ *
+ * Returns NO if there is none. Otherwise `unlockFrame` must be called once the
+ * pixels are no longer read.
+ */
+- (BOOL)lockFrame:(MSPlane *)plane {
+    if (_pixelBuffer != NULL) {
+        CVPixelBufferLockBaseAddress(_pixelBuffer, kCVPixelBufferLock_ReadOnly);
+        if (MSPlaneFromPixelBuffer(_pixelBuffer, plane)) return YES;
+        CVPixelBufferUnlockBaseAddress(_pixelBuffer, kCVPixelBufferLock_ReadOnly);
+        return NO;
+    }
+    if (_gray != NULL) {
+        MSPlane gray = { _gray, _grayWidth, _grayHeight, _grayWidth, MS_PIX_FMT_GRAY8 };
+        *plane = gray;
+        return YES;
+    }
+    return NO;
+}
+
+- (void)unlockFrame {
+    if (_pixelBuffer != NULL)
+        CVPixelBufferUnlockBaseAddress(_pixelBuffer, kCVPixelBufferLock_ReadOnly);
+}
 #endif
 
+- (const uint8_t *)thumbnail {
+    return _hasThumb ? _thumb : NULL;
+}
+
+- (void)setupWithPlane:(const MSPlane *)plane orientation:(ms_ori_t)orientation {
+    _ori = orientation;
+    MSGrayThumbnail(plane, _thumb, MS_THUMB_WIDTH, MS_THUMB_HEIGHT);
+    _hasThumb = YES;
+#if MS_SDK_REQUIREMENTS
+    ms_img_t *img = NULL;
+    ms_errcode ecode = ms_img_new_from_plane(plane, orientation, &img);
+    _img = (ecode == MS_SUCCESS) ? img : NULL;
+    if (_img != NULL) {
+        // Oversize planes are downscaled (see `ms_img_new_from_plane`)
+        int levels = MSGrayDownscaleLevels(plane->width, plane->height);
+        if (levels < 0) levels = 0;
+        _width = plane->width >> levels;
+        _height = plane->height >> levels;
+    }
+#endif
+}
+
 - (void)dealloc {
 #if MS_SDK_REQUIREMENTS
     if (_img) ms_img_del(_img);
 #endif
     _img = NULL;
     
+#if MS_IPHONE_OS_REQUIREMENTS
+    if (_pixelBuffer) CVPixelBufferRelease(_pixelBuffer);
+    _pixelBuffer = NULL;
+    free(_gray);
+    _gray = NULL;
+#endif
+    
 #if ! __has_feature(objc_arc)
     [super dealloc];
 #endif
@@ -93,47 +397,49 @@ ms_img_t *MSCreateImageFromSampleBuffer(CMSampleBufferRef sbuf) {
     return MSCreateImageFromSampleBuffer2(sbuf, -1);
 }
 
+BOOL MSPlaneFromPixelBuffer(CVPixelBufferRef buf, MSPlane *plane) {
+    switch (CVPixelBufferGetPixelFormatType(buf)) {
+        case kCVPixelFormatType_32BGRA:
+            plane->data = CVPixelBufferGetBaseAddress(buf);
+            plane->width = (int) CVPixelBufferGetWidth(buf);
+            plane->height = (int) CVPixelBufferGetHeight(buf);
+            plane->bpr = (int) CVPixelBufferGetBytesPerRow(buf);
+            plane->format = MS_PIX_FMT_RGB32;
+            return YES;
+
+        case kCVPixelFormatType_420YpCbCr8BiPlanarFullRange:
+        case kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange:
+            // The luma plane is all we need: the chroma plane is never touched
+            plane->data = CVPixelBufferGetBaseAddressOfPlane(buf, 0);
+            plane->width = (int) CVPixelBufferGetWidthOfPlane(buf, 0);
+            plane->height = (int) CVPixelBufferGetHeightOfPlane(buf, 0);
+            plane->bpr = (int) CVPixelBufferGetBytesPerRowOfPlane(buf, 0);
+            plane->format = MS_PIX_FMT_GRAY8;
+            return YES;
+
+        default:
+            return NO;
+    }
+}
+
 ms_img_t *MSCreateImageFromSampleBuffer2(CMSampleBufferRef sbuf, AVCaptureVideoOrientation orientation) {
 #if MS_SDK_REQUIREMENTS
     CVImageBufferRef imageBuffer = CMSampleBufferGetImageBuffer(sbuf);
     
-    if (CVPixelBufferGetPixelFormatType(imageBuffer) != kCVPixelFormatType_32BGRA)
-        return NULL;
-    
-    CVPixelBufferLockBaseAddress(imageBuffer, 0); 
-    
-    void *data = CVPixelBufferGetBaseAddress(imageBuffer); 
-    size_t bpr = CVPixelBufferGetBytesPerRow(imageBuffer); 
-    size_t width = CVPixelBufferGetWidth(imageBuffer); 
-    size_t height = CVPixelBufferGetHeight(imageBuffer);
+    CVPixelBufferLockBaseAddress(imageBuffer, kCVPixelBufferLock_ReadOnly);
     
-    ms_pix_fmt_t fmt = MS_PIX_FMT_RGB32;
-    ms_ori_t ori = MS_UNDEFINED_ORI;
-    switch (orientation) {
-        case AVCaptureVideoOrientationPortrait:
-            ori = MS_LEFT_BOTTOM_ORI;
-            break;
-            
-        case AVCaptureVideoOrientationLandscapeRight:
-            ori = MS_TOP_LEFT_ORI;
-            break;
-            
-        case AVCaptureVideoOrientationLandscapeLeft:
-            ori = MS_BOTTOM_RIGHT_ORI;
-            break;
-            
-        case AVCaptureVideoOrientationPortraitUpsideDown:
-            ori = MS_RIGHT_TOP_ORI;
-            break;
-            
-        default:
-            break;
+    MSPlane plane;
+    if (!MSPlaneFromPixelBuffer(imageBuffer, &plane)) {
+        CVPixelBufferUnlockBaseAddress(imageBuffer, kCVPixelBufferLock_ReadOnly);
+        return NULL;
     }
     
+    ms_ori_t ori = ms_ori_from_video_orientation(orientation);
+    
     ms_img_t *img;
-    ms_errcode ecode = ms_img_new(data, width, height, bpr, fmt, ori, &img);
+    ms_errcode ecode = ms_img_new_from_plane(&plane, ori, &img);
     
-    CVPixelBufferUnlockBaseAddress(imageBuffer, 0);
+    CVPixelBufferUnlockBaseAddress(imageBuffer, kCVPixelBufferLock_ReadOnly);
     
     return (ecode == MS_SUCCESS) ? img : NULL;
 #else
@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Usage counters of an image pool
+ */
+typedef struct {
+    NSUInteger hits;        /* number of leases served by an idle pooled buffer */
+    NSUInteger misses;      /* number of leases that required an allocation */
+    size_t residentBytes;   /* number of bytes currently allocated */
+    size_t peakBytes;       /* highest number of bytes allocated at once */
+} MSImagePoolStats;
+
+/**
+ * Fixed-capacity ring of reusable pixel buffers
+ *
+ * Buffers are leased for the time needed to build an image (e.g. to convert
+ * or downscale a camera frame before `ms_img_new` is called) then returned to
+ * the pool, so that steady state scanning does not allocate nor free any
+ * pixel buffer per frame.
+ *
+ * A pooled buffer is allocated the first time it is needed and grows if a
+ * larger buffer is later requested. When all pooled buffers are leased, a
+ * temporary buffer is allocated and freed when returned.
+ *
+ * This class is thread safe.
+ */
+@interface MSImagePool : NSObject {
+    void **_buffers;
+    size_t *_sizes;
+    BOOL *_leased;
+    NSUInteger _capacity;
+    NSUInteger _next;
+    MSImagePoolStats _stats;
+}
+
+/** Usage counters */
+@property (readonly) MSImagePoolStats stats;
+
+/**
+ * Obtain the pool shared by all images
+ */
++ (MSImagePool *)sharedPool;
+
+/**
+ * Create a pool made of `capacity` buffers
+ */
+- (id)initWithCapacity:(NSUInteger)capacity;
+
+/**
+ * Lease a buffer of at least `size` bytes
+ *
+ * Returns NULL if the allocation failed or if `size` is 0. The buffer must be
+ * given back with `returnBuffer:` once it is no longer useful.
+ */
+- (void *)leaseBuffer:(size_t)size;
+
+/**
+ * Give back a buffer obtained with `leaseBuffer:`
+ */
+- (void)returnBuffer:(void *)buffer;
+
+/**
+ * Release all the idle pooled buffers (e.g. on memory warnings)
+ */
+- (void)drain;
+
+@end
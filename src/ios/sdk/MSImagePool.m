@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSImagePool.h"
+#import "MSAvailability.h"
+#import "MSObjC.h"
+
+#include <stdlib.h>
+
+/** Number of buffers held by the shared pool */
+#define MS_IMAGE_POOL_CAPACITY 4
+
+static MSImagePool *gMSImagePool = nil;
+
+@interface MSImagePool ()
+- (void)allocated:(size_t)size;
+- (void)freed:(size_t)size;
+@end
+
+@implementation MSImagePool
+
++ (MSImagePool *)sharedPool {
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        gMSImagePool = [[MSImagePool alloc] initWithCapacity:MS_IMAGE_POOL_CAPACITY];
+#if MS_IPHONE_OS_REQUIREMENTS
+        [[NSNotificationCenter defaultCenter] addObserver:gMSImagePool
+                                                 selector:@selector(drain)
+                                                     name:UIApplicationDidReceiveMemoryWarningNotification
+                                                   object:nil];
+#endif
+    });
+    return gMSImagePool;
+}
+
+- (id)initWithCapacity:(NSUInteger)capacity {
+    self = [super init];
+    if (self) {
+        _capacity = capacity;
+        _next = 0;
+        _buffers = (void **) calloc(capacity, sizeof(void *));
+        _sizes = (size_t *) calloc(capacity, sizeof(size_t));
+        _leased = (BOOL *) calloc(capacity, sizeof(BOOL));
+        memset(&_stats, 0, sizeof(_stats));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (NSUInteger i = 0; i < _capacity; i++)
+        free(_buffers[i]);
+    free(_buffers);
+    free(_sizes);
+    free(_leased);
+    _buffers = NULL;
+    _sizes = NULL;
+    _leased = NULL;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (MSImagePoolStats)stats {
+    MSImagePoolStats stats;
+    @synchronized(self) {
+        stats = _stats;
+    }
+    return stats;
+}
+
+- (void *)leaseBuffer:(size_t)size {
+    // Nothing to hand out: keep the slots available
+    if (size == 0) return NULL;
+
+    @synchronized(self) {
+        // Walk the ring from the last leased slot so that buffers are
+        // reused in turn
+        NSUInteger idle = _capacity;
+        for (NSUInteger n = 0; n < _capacity; n++) {
+            NSUInteger i = (_next + n) % _capacity;
+            if (_leased[i]) continue;
+            if (_sizes[i] >= size) {
+                _leased[i] = YES;
+                _next = (i + 1) % _capacity;
+                _stats.hits++;
+                return _buffers[i];
+            }
+            if (idle == _capacity) idle = i;
+        }
+
+        _stats.misses++;
+
+        if (idle < _capacity) {
+            // Grow an idle pooled buffer
+            void *buf = malloc(size);
+            if (buf == NULL) return NULL;
+            free(_buffers[idle]);
+            [self freed:_sizes[idle]];
+            [self allocated:size];
+            _buffers[idle] = buf;
+            _sizes[idle] = size;
+            _leased[idle] = YES;
+            _next = (idle + 1) % _capacity;
+            return buf;
+        }
+
+        // The pool is exhausted: use a temporary buffer prefixed by its size
+        size_t *buf = (size_t *) malloc(sizeof(size_t) + size);
+        if (buf == NULL) return NULL;
+        buf[0] = size;
+        [self allocated:size];
+        return buf + 1;
+    }
+}
+
+- (void)returnBuffer:(void *)buffer {
+    if (buffer == NULL) return;
+    @synchronized(self) {
+        for (NSUInteger i = 0; i < _capacity; i++) {
+            if (_buffers[i] == buffer) {
+                _leased[i] = NO;
+                return;
+            }
+        }
+
+        size_t *buf = ((size_t *) buffer) - 1;
+        [self freed:buf[0]];
+        free(buf);
+    }
+}
+
+- (void)drain {
+    @synchronized(self) {
+        for (NSUInteger i = 0; i < _capacity; i++) {
+            if (_leased[i]) continue;
+            free(_buffers[i]);
+            [self freed:_sizes[i]];
+            _buffers[i] = NULL;
+            _sizes[i] = 0;
+        }
+    }
+}
+
+#pragma mark - Private
+
+- (void)allocated:(size_t)size {
+    _stats.residentBytes += size;
+    if (_stats.residentBytes > _stats.peakBytes)
+        _stats.peakBytes = _stats.residentBytes;
+}
+
+- (void)freed:(size_t)size {
+    _stats.residentBytes -= size;
+}
+
+@end
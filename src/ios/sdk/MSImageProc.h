@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "moodstocks_sdk.h"
+
+/**
+ * Description of a single plane of pixels owned by the caller
+ *
+ * It is used to hand raw pixels over to the Moodstocks SDK without any
+ * intermediate copy, e.g. the luma plane of a bi-planar YUV camera frame
+ * can be described as a `MS_PIX_FMT_GRAY8` plane.
+ */
+typedef struct {
+    const void *data;       /* pointer to the first row of pixels */
+    int width;              /* width in pixels */
+    int height;             /* height in pixels */
+    int bpr;                /* size of a row in bytes (including padding) */
+    ms_pix_fmt_t format;    /* pixel format */
+} MSPlane;
+
+/**
+ * 8-bit gray image preprocessing
+ * --
+ * These kernels prepare exactly-sized gray buffers before `ms_img_new` is
+ * called, e.g. to bring a frame larger than 1280x720 down to the supported
+ * size or to crop a region of interest.
+ *
+ * The conversion and downscale kernels come with a portable scalar
+ * implementation and a NEON implementation used whenever the target supports
+ * it (which is always the case when `MS_SDK_REQUIREMENTS` is fulfilled). Both
+ * produce bit-exact results, which `make -C tests check` enforces on ARM hosts.
+ *
+ * This header and `MSImageProc.m` are plain C so that the kernels can be built
+ * and tested without the iOS SDK.
+ *
+ * All buffers are provided by the caller. Unless otherwise stated source and
+ * destination must not overlap.
+ */
+
+/** Largest image width accepted by `ms_img_new` */
+#define MS_IMG_MAX_WIDTH  1280
+/** Largest image height accepted by `ms_img_new` */
+#define MS_IMG_MAX_HEIGHT 720
+/** Smallest value accepted by `ms_img_new` for the largest image dimension */
+#define MS_IMG_MIN_SIZE   480
+
+/**
+ * Convert a plane to 8-bit gray
+ *
+ * - `MS_PIX_FMT_RGB32` pixels are converted with the ITU-R BT.601 luma
+ *   weights, i.e. Y = (77 R + 150 G + 29 B + 128) >> 8,
+ * - `MS_PIX_FMT_GRAY8` and `MS_PIX_FMT_NV21` planes are copied as is (only
+ *   the luma plane is read for NV21).
+ *
+ * `dst` must hold `src->height` rows of `dbpr` bytes.
+ */
+void MSGrayFromPlane(const MSPlane *src, uint8_t *dst, int dbpr);
+
+/**
+ * Compute a `tw` x `th` gray thumbnail of a plane
+ *
+ * Each thumbnail pixel is the average of 4x4 pixels evenly sampled over the
+ * corresponding area of the plane. This is meant to be cheap enough to run on
+ * every camera frame, e.g. to measure how much the scene changed between two
+ * frames.
+ *
+ * `dst` must hold `tw * th` bytes.
+ */
+void MSGrayThumbnail(const MSPlane *src, uint8_t *dst, int tw, int th);
+
+/**
+ * Mean absolute difference between two gray buffers of `n` bytes
+ */
+int MSGrayMeanAbsDiff(const uint8_t *a, const uint8_t *b, int n);
+
+/**
+ * 64-bit difference hash (dHash) of a `w` x `h` gray buffer
+ *
+ * The buffer is averaged down to a 9x8 grid and each bit tells whether a cell
+ * is darker than its right neighbour. Near-duplicate images have hashes a few
+ * bits apart (see `MSHammingDistance`) whatever their exposure.
+ *
+ * The buffer must be at least 9x8 pixels (e.g. a thumbnail).
+ */
+uint64_t MSGrayDHash(const uint8_t *src, int w, int h);
+
+/**
+ * Number of different bits between two 64-bit hashes
+ */
+int MSHammingDistance(uint64_t a, uint64_t b);
+
+/**
+ * Normalized cross-correlation between a `pw` x `ph` gray patch (tightly packed)
+ * and the window of the same size whose top-left corner is at (`x`, `y`) in a
+ * gray image of `sbpr` bytes per row
+ *
+ * Returns a score within [-1, 1] (1 for identical contents whatever the exposure)
+ * or 0 if either the patch or the window is flat. The window must lie within
+ * the image.
+ */
+float MSGrayNCC(const uint8_t *src, int sbpr, int x, int y,
+                const uint8_t *patch, int pw, int ph);
+
+/**
+ * Downscale a gray image by a factor of 2 with a 2x2 box filter
+ *
+ * The destination image is `w / 2` x `h / 2` pixels (an odd last row or
+ * column is dropped). This kernel can work in place (i.e. `dst == src`
+ * with `dbpr <= sbpr`).
+ */
+void MSGrayDownscale2x(const uint8_t *src, int w, int h, int sbpr,
+                       uint8_t *dst, int dbpr);
+
+/**
+ * Resize a gray image to `dw` x `dh` pixels with a bilinear filter
+ *
+ * This is meant for downscale factors between 1 and 2: larger factors should
+ * first go through `MSGrayDownscale2x` to avoid aliasing.
+ */
+void MSGrayResize(const uint8_t *src, int w, int h, int sbpr,
+                  uint8_t *dst, int dw, int dh, int dbpr);
+
+/**
+ * Number of 2x downscales required so that a `w` x `h` image fits into the
+ * `ms_img_new` limits while keeping its largest dimension above the minimum
+ * size
+ *
+ * Returns -1 if no such number exists.
+ */
+int MSGrayDownscaleLevels(int w, int h);
+
+/** Side of the square cells over which `MSGrayCodeRegions` measures the gradient */
+#define MS_CODE_CELL 8
+
+/** Number of `int` of the scratch buffer required by `MSGrayCodeRegions` */
+#define MS_CODE_REGIONS_SCRATCH(w, h) (2 * ((w) / MS_CODE_CELL) * ((h) / MS_CODE_CELL))
+
+/** Rectangle in pixels */
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} MSGrayRect;
+
+/**
+ * Locate the areas of a gray image that are likely to contain a barcode
+ *
+ * The image is split into `MS_CODE_CELL` pixels wide cells, and the cells
+ * whose mean gradient stands out (i.e. well above the image average) are
+ * grouped into connected regions, after a dilation of one cell that bridges
+ * the gaps (e.g. between the bars of a linear barcode). There is no erosion:
+ * the dilated cells are kept, so each region comes with a margin of one cell
+ * and the quiet zone of the code is kept.
+ *
+ * `scratch` must hold `MS_CODE_REGIONS_SCRATCH(w, h)` integers. At most `max`
+ * regions are stored into `rects`, from the most to the least textured one.
+ *
+ * Returns the number of regions found.
+ */
+int MSGrayCodeRegions(const uint8_t *src, int w, int h, int sbpr,
+                      int *scratch, MSGrayRect *rects, int max);
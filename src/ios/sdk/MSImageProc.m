@@ -0,0 +1,345 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSImageProc.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Define MS_IMAGE_PROC_NEON to 0 to force the scalar kernels (see tests/) */
+#ifndef MS_IMAGE_PROC_NEON
+  #if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    #define MS_IMAGE_PROC_NEON 1
+  #else
+    #define MS_IMAGE_PROC_NEON 0
+  #endif
+#endif
+
+#if MS_IMAGE_PROC_NEON
+  #include <arm_neon.h>
+#endif
+
+/** Smallest mean gradient of a cell that may belong to a barcode */
+#define MS_CODE_MIN_GRADIENT 16
+/** Smallest number of textured cells for a region to be reported */
+#define MS_CODE_MIN_CELLS 4
+
+#pragma mark - Color conversion
+
+static void ms_gray_from_rgb32_row(const uint8_t *src, uint8_t *dst, int w) {
+    int x = 0;
+#if MS_IMAGE_PROC_NEON
+    const uint8x8_t kb = vdup_n_u8(29);
+    const uint8x8_t kg = vdup_n_u8(150);
+    const uint8x8_t kr = vdup_n_u8(77);
+    for (; x + 8 <= w; x += 8) {
+        uint8x8x4_t bgra = vld4_u8(src + 4 * x);
+        uint16x8_t y = vmull_u8(bgra.val[0], kb);
+        y = vmlal_u8(y, bgra.val[1], kg);
+        y = vmlal_u8(y, bgra.val[2], kr);
+        vst1_u8(dst + x, vrshrn_n_u16(y, 8));
+    }
+#endif
+    for (; x < w; x++) {
+        const uint8_t *p = src + 4 * x;
+        dst[x] = (uint8_t) ((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8);
+    }
+}
+
+void MSGrayFromPlane(const MSPlane *src, uint8_t *dst, int dbpr) {
+    const uint8_t *s = (const uint8_t *) src->data;
+    for (int y = 0; y < src->height; y++) {
+        if (src->format == MS_PIX_FMT_RGB32)
+            ms_gray_from_rgb32_row(s, dst, src->width);
+        else
+            memcpy(dst, s, src->width);
+        s += src->bpr;
+        dst += dbpr;
+    }
+}
+
+#pragma mark - Thumbnail
+
+static inline int ms_luma_at(const MSPlane *src, int x, int y) {
+    const uint8_t *row = (const uint8_t *) src->data + y * src->bpr;
+    if (src->format == MS_PIX_FMT_RGB32) {
+        const uint8_t *p = row + 4 * x;
+        return (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8;
+    }
+    return row[x];
+}
+
+void MSGrayThumbnail(const MSPlane *src, uint8_t *dst, int tw, int th) {
+    for (int cy = 0; cy < th; cy++) {
+        const int y0 = cy * src->height / th;
+        const int ch = (cy + 1) * src->height / th - y0;
+        for (int cx = 0; cx < tw; cx++) {
+            const int x0 = cx * src->width / tw;
+            const int cw = (cx + 1) * src->width / tw - x0;
+            int sum = 0;
+            for (int j = 0; j < 4; j++) {
+                const int y = y0 + (2 * j + 1) * ch / 8;
+                for (int i = 0; i < 4; i++)
+                    sum += ms_luma_at(src, x0 + (2 * i + 1) * cw / 8, y);
+            }
+            dst[cy * tw + cx] = (uint8_t) ((sum + 8) >> 4);
+        }
+    }
+}
+
+int MSGrayMeanAbsDiff(const uint8_t *a, const uint8_t *b, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+    return (n > 0) ? sum / n : 0;
+}
+
+uint64_t MSGrayDHash(const uint8_t *src, int w, int h) {
+    int grid[8][9];
+    for (int cy = 0; cy < 8; cy++) {
+        const int y0 = (cy * h) / 8;
+        const int y1 = ((cy + 1) * h) / 8;
+        for (int cx = 0; cx < 9; cx++) {
+            const int x0 = (cx * w) / 9;
+            const int x1 = ((cx + 1) * w) / 9;
+            int sum = 0;
+            for (int y = y0; y < y1; y++)
+                for (int x = x0; x < x1; x++)
+                    sum += src[y * w + x];
+            grid[cy][cx] = sum / ((y1 - y0) * (x1 - x0));
+        }
+    }
+
+    uint64_t hash = 0;
+    for (int cy = 0; cy < 8; cy++)
+        for (int cx = 0; cx < 8; cx++)
+            hash = (hash << 1) | (grid[cy][cx] < grid[cy][cx + 1] ? 1 : 0);
+    return hash;
+}
+
+int MSHammingDistance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
+
+float MSGrayNCC(const uint8_t *src, int sbpr, int x, int y,
+                const uint8_t *patch, int pw, int ph) {
+    int64_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+    for (int j = 0; j < ph; j++) {
+        const uint8_t *a = src + (y + j) * sbpr + x;
+        const uint8_t *b = patch + j * pw;
+        for (int i = 0; i < pw; i++) {
+            sa += a[i];
+            sb += b[i];
+            saa += a[i] * a[i];
+            sbb += b[i] * b[i];
+            sab += a[i] * b[i];
+        }
+    }
+    const int64_t n = (int64_t) pw * ph;
+    const double va = (double) (n * saa - sa * sa);
+    const double vb = (double) (n * sbb - sb * sb);
+    if (va <= 0 || vb <= 0) return 0;
+    return (float) ((n * sab - sa * sb) / sqrt(va * vb));
+}
+
+#pragma mark - Downscale
+
+void MSGrayDownscale2x(const uint8_t *src, int w, int h, int sbpr,
+                       uint8_t *dst, int dbpr) {
+    const int dw = w / 2;
+    const int dh = h / 2;
+    for (int y = 0; y < dh; y++) {
+        const uint8_t *r0 = src + (2 * y) * sbpr;
+        const uint8_t *r1 = r0 + sbpr;
+        uint8_t *d = dst + y * dbpr;
+        int x = 0;
+#if MS_IMAGE_PROC_NEON
+        for (; x + 8 <= dw; x += 8) {
+            uint16x8_t sum = vpaddlq_u8(vld1q_u8(r0 + 2 * x));
+            sum = vpadalq_u8(sum, vld1q_u8(r1 + 2 * x));
+            vst1_u8(d + x, vrshrn_n_u16(sum, 2));
+        }
+#endif
+        for (; x < dw; x++) {
+            d[x] = (uint8_t) ((r0[2 * x] + r0[2 * x + 1] + r1[2 * x] + r1[2 * x + 1] + 2) >> 2);
+        }
+    }
+}
+
+void MSGrayResize(const uint8_t *src, int w, int h, int sbpr,
+                  uint8_t *dst, int dw, int dh, int dbpr) {
+    // 16.16 fixed-point source coordinates of the destination pixel centers
+    const int64_t sx = ((int64_t) w << 16) / dw;
+    const int64_t sy = ((int64_t) h << 16) / dh;
+    for (int y = 0; y < dh; y++) {
+        int64_t fy = (y * sy) + (sy >> 1) - (1 << 15);
+        if (fy < 0) fy = 0;
+        int y0 = (int) (fy >> 16);
+        int wy = (int) ((fy >> 8) & 0xff);
+        if (y0 >= h - 1) {
+            y0 = h - 1;
+            wy = 0;
+        }
+        const uint8_t *r0 = src + y0 * sbpr;
+        const uint8_t *r1 = (y0 + 1 < h) ? r0 + sbpr : r0;
+        uint8_t *d = dst + y * dbpr;
+        for (int x = 0; x < dw; x++) {
+            int64_t fx = (x * sx) + (sx >> 1) - (1 << 15);
+            if (fx < 0) fx = 0;
+            int x0 = (int) (fx >> 16);
+            int wx = (int) ((fx >> 8) & 0xff);
+            if (x0 >= w - 1) {
+                x0 = w - 1;
+                wx = 0;
+            }
+            const int x1 = (x0 + 1 < w) ? x0 + 1 : x0;
+            const int top = r0[x0] * (256 - wx) + r0[x1] * wx;
+            const int bottom = r1[x0] * (256 - wx) + r1[x1] * wx;
+            d[x] = (uint8_t) ((top * (256 - wy) + bottom * wy + (1 << 15)) >> 16);
+        }
+    }
+}
+
+int MSGrayDownscaleLevels(int w, int h) {
+    int levels = 0;
+    while (w > MS_IMG_MAX_WIDTH || h > MS_IMG_MAX_HEIGHT) {
+        w /= 2;
+        h /= 2;
+        levels++;
+    }
+    return ((w > h ? w : h) >= MS_IMG_MIN_SIZE) ? levels : -1;
+}
+
+#pragma mark - Code localization
+
+int MSGrayCodeRegions(const uint8_t *src, int w, int h, int sbpr,
+                      int *scratch, MSGrayRect *rects, int max) {
+    const int cw = w / MS_CODE_CELL;
+    const int ch = h / MS_CODE_CELL;
+    if (cw < 3 || ch < 3 || max <= 0) return 0;
+
+    const int n = cw * ch;
+    int *cells = scratch;
+    int *stack = scratch + n;
+
+    // Mean absolute gradient of each cell (central differences)
+    int64_t total = 0;
+    for (int cy = 0; cy < ch; cy++) {
+        const int y0 = (cy == 0) ? 1 : cy * MS_CODE_CELL;
+        const int y1 = (cy == ch - 1 && ch * MS_CODE_CELL == h) ? h - 1 : (cy + 1) * MS_CODE_CELL;
+        for (int cx = 0; cx < cw; cx++) {
+            const int x0 = (cx == 0) ? 1 : cx * MS_CODE_CELL;
+            const int x1 = (cx == cw - 1 && cw * MS_CODE_CELL == w) ? w - 1 : (cx + 1) * MS_CODE_CELL;
+            int sum = 0;
+            for (int y = y0; y < y1; y++) {
+                const uint8_t *s = src + y * sbpr;
+                for (int x = x0; x < x1; x++) {
+                    sum += abs(s[x + 1] - s[x - 1]);
+                    sum += abs(s[x + sbpr] - s[x - sbpr]);
+                }
+            }
+            cells[cy * cw + cx] = sum / ((y1 - y0) * (x1 - x0));
+            total += cells[cy * cw + cx];
+        }
+    }
+
+    // Textured cells (bit 0), then the cells next to them (bit 1)
+    int threshold = (int) ((3 * total) / (2 * n));
+    if (threshold < MS_CODE_MIN_GRADIENT) threshold = MS_CODE_MIN_GRADIENT;
+    for (int i = 0; i < n; i++)
+        cells[i] = (cells[i] >= threshold) ? 1 : 0;
+    for (int cy = 0; cy < ch; cy++) {
+        for (int cx = 0; cx < cw; cx++) {
+            int *c = &cells[cy * cw + cx];
+            if (*c) continue;
+            for (int dy = -1; dy <= 1 && !*c; dy++) {
+                if (cy + dy < 0 || cy + dy >= ch) continue;
+                for (int dx = -1; dx <= 1; dx++) {
+                    if (cx + dx < 0 || cx + dx >= cw) continue;
+                    if (cells[(cy + dy) * cw + cx + dx] & 1) {
+                        *c = 2;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Connected regions: each cell is pushed at most once since it is marked
+    // as visited (i.e. negative) at that time
+    int count = 0;
+    int weights[max];
+    for (int seed = 0; seed < n; seed++) {
+        if (cells[seed] <= 0) continue;
+
+        int top = 0;
+        int weight = 0;
+        int minx = cw, miny = ch, maxx = -1, maxy = -1;
+        stack[top++] = seed;
+        cells[seed] = -cells[seed];
+        while (top > 0) {
+            const int i = stack[--top];
+            const int cx = i % cw;
+            const int cy = i / cw;
+            if (-cells[i] & 1) weight++;
+            if (cx < minx) minx = cx;
+            if (cx > maxx) maxx = cx;
+            if (cy < miny) miny = cy;
+            if (cy > maxy) maxy = cy;
+
+            const int neighbors[4] = {
+                (cx > 0) ? i - 1 : -1,
+                (cx < cw - 1) ? i + 1 : -1,
+                (cy > 0) ? i - cw : -1,
+                (cy < ch - 1) ? i + cw : -1
+            };
+            for (int k = 0; k < 4; k++) {
+                const int j = neighbors[k];
+                if (j < 0 || cells[j] <= 0) continue;
+                cells[j] = -cells[j];
+                stack[top++] = j;
+            }
+        }
+
+        if (weight < MS_CODE_MIN_CELLS) continue;
+
+        // Keep the `max` most textured regions, sorted by decreasing weight
+        int pos = (count < max) ? count : max;
+        while (pos > 0 && weights[pos - 1] < weight) pos--;
+        if (pos >= max) continue;
+        const int last = (count < max) ? count : max - 1;
+        for (int k = last; k > pos; k--) {
+            weights[k] = weights[k - 1];
+            rects[k] = rects[k - 1];
+        }
+        weights[pos] = weight;
+        rects[pos].x = minx * MS_CODE_CELL;
+        rects[pos].y = miny * MS_CODE_CELL;
+        rects[pos].width = ((maxx + 1) * MS_CODE_CELL > w ? w : (maxx + 1) * MS_CODE_CELL) - rects[pos].x;
+        rects[pos].height = ((maxy + 1) * MS_CODE_CELL > h ? h : (maxy + 1) * MS_CODE_CELL) - rects[pos].y;
+        if (count < max) count++;
+    }
+
+    return count;
+}
@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+#import "MSAvailability.h"
+#import "MSImage.h"
+
+/**
+ * Offline queue counters accumulated since the queue has been opened
+ */
+typedef struct {
+    int64_t queued;         /* number of queries pushed */
+    int64_t dropped;        /* number of queries evicted (full queue or too many attempts) */
+    int64_t retries;        /* number of failed re-submissions */
+    int64_t delivered;      /* number of queries re-submitted successfully */
+} MSOfflineQueueStats;
+
+/**
+ * Query image saved by the offline queue
+ */
+@interface MSQueuedQuery : NSObject {
+    NSString *_identifier;
+    NSTimeInterval _timestamp;
+    NSUInteger _attempts;
+    MSImage *_image;
+}
+
+/** Unique identifier of the query within the queue */
+@property (nonatomic, readonly) NSString *identifier;
+/** Time at which the query has been queued (seconds since 1970) */
+@property (nonatomic, readonly) NSTimeInterval timestamp;
+/** Number of failed re-submissions so far */
+@property (nonatomic, readonly) NSUInteger attempts;
+/** Query image (`nil` unless loaded with `-[MSOfflineQueue queryWithIdentifier:]`) */
+@property (nonatomic, readonly) MSImage *image;
+
+@end
+
+/**
+ * Bounded on-disk queue of the online searches that could not be performed
+ * for lack of connectivity
+ *
+ * Each query is saved as a zlib compressed 8-bit gray frame (downscaled to the
+ * minimum size accepted by the API) into its own file under the queue directory,
+ * so that it survives the application being killed. The oldest query is evicted
+ * when the queue is full.
+ *
+ * This class is thread safe.
+ */
+@interface MSOfflineQueue : NSObject {
+    NSString *_path;
+    NSUInteger _capacity;
+    NSUInteger _maxAttempts;
+    NSMutableArray *_identifiers;
+    uint32_t _seq;
+    MSOfflineQueueStats _stats;
+}
+
+/** Path of the queue directory */
+@property (nonatomic, readonly) NSString *path;
+/** Maximum number of queries kept on disk */
+@property (nonatomic, readonly) NSUInteger capacity;
+/** Number of failed re-submissions after which a query is dropped (default: 5) */
+@property (assign) NSUInteger maxAttempts;
+/** Number of queries in the queue */
+@property (readonly) NSUInteger count;
+/** Age in seconds of the oldest query in the queue (0 if empty) */
+@property (readonly) NSTimeInterval oldestAge;
+/** Queue counters */
+@property (readonly) MSOfflineQueueStats stats;
+
+/**
+ * Open the queue stored into the given directory (created if needed)
+ */
+- (id)initWithPath:(NSString *)path capacity:(NSUInteger)capacity;
+
+#if MS_IPHONE_OS_REQUIREMENTS
+/**
+ * Save a query image into the queue
+ *
+ * The image must have been created from a camera frame. Returns the queued query
+ * (without its image) or nil on error.
+ */
+- (MSQueuedQuery *)push:(MSImage *)qry error:(NSError **)error;
+#endif
+
+/**
+ * Identifiers of the queued queries, oldest first
+ */
+- (NSArray *)identifiers;
+
+/**
+ * Load a queued query along with its image (nil if it is no longer in the queue)
+ */
+- (MSQueuedQuery *)queryWithIdentifier:(NSString *)identifier;
+
+/**
+ * Remove a query once it has been re-submitted successfully
+ */
+- (void)remove:(MSQueuedQuery *)query;
+
+/**
+ * Record a failed re-submission of a query
+ *
+ * If `drop` is YES the query is removed once it has reached `maxAttempts`, in
+ * which case YES is returned. Transient failures (e.g. still no connection)
+ * should not drop the query.
+ */
+- (BOOL)fail:(MSQueuedQuery *)query drop:(BOOL)drop;
+
+/**
+ * Remove all the queued queries
+ */
+- (void)clear;
+
+@end
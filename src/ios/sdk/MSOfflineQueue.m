@@ -0,0 +1,352 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#import "MSOfflineQueue.h"
+#import "MSImageProc.h"
+#import "MSDebug.h"
+#import "MSObjC.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/** Magic number of the queued query files ("MSQ1") */
+#define MS_QUEUE_MAGIC 0x3151534d
+
+/** Default number of failed re-submissions after which a query is dropped */
+#define MS_QUEUE_MAX_ATTEMPTS 5
+
+static NSString *kMSQueuedQueryExtension = @"msq";
+
+/**
+ * Header of a queued query file, followed by the compressed gray pixels
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t attempts;
+    int32_t width;
+    int32_t height;
+    int32_t orientation;
+    uint32_t length;        /* size in bytes of the compressed pixels */
+    double timestamp;       /* seconds since 1970 */
+} MSQueuedHeader;
+
+@interface MSQueuedQuery ()
+@property (nonatomic, assign) NSUInteger attempts;
+- (id)initWithIdentifier:(NSString *)identifier
+               timestamp:(NSTimeInterval)timestamp
+                attempts:(NSUInteger)attempts
+                   image:(MSImage *)image;
+@end
+
+@implementation MSQueuedQuery
+
+@synthesize identifier = _identifier;
+@synthesize timestamp = _timestamp;
+@synthesize attempts = _attempts;
+@synthesize image = _image;
+
+- (id)initWithIdentifier:(NSString *)identifier
+               timestamp:(NSTimeInterval)timestamp
+                attempts:(NSUInteger)attempts
+                   image:(MSImage *)image {
+    self = [super init];
+    if (self) {
+        _identifier = [identifier copy];
+        _timestamp = timestamp;
+        _attempts = attempts;
+        _image = [image retain_stub];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_identifier release_stub];
+    _identifier = nil;
+    [_image release_stub];
+    _image = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+@end
+
+@interface MSOfflineQueue ()
+- (NSString *)pathForIdentifier:(NSString *)identifier;
+- (void)removeIdentifier:(NSString *)identifier;
+@end
+
+@implementation MSOfflineQueue
+
+@synthesize path = _path;
+@synthesize capacity = _capacity;
+@dynamic maxAttempts;
+@dynamic count;
+@dynamic oldestAge;
+@dynamic stats;
+
+- (id)initWithPath:(NSString *)path capacity:(NSUInteger)capacity {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _capacity = (capacity > 0) ? capacity : 1;
+        _maxAttempts = MS_QUEUE_MAX_ATTEMPTS;
+        _identifiers = [[NSMutableArray alloc] init];
+        _seq = 0;
+        memset(&_stats, 0, sizeof(_stats));
+
+        NSFileManager *fm = [NSFileManager defaultManager];
+        [fm createDirectoryAtPath:_path withIntermediateDirectories:YES attributes:nil error:nil];
+
+        // Identifiers start with the queuing time: sorting them gives the FIFO order
+        for (NSString *name in [fm contentsOfDirectoryAtPath:_path error:nil]) {
+            if ([[name pathExtension] isEqualToString:kMSQueuedQueryExtension])
+                [_identifiers addObject:[name stringByDeletingPathExtension]];
+        }
+        [_identifiers sortUsingSelector:@selector(compare:)];
+        while ([_identifiers count] > _capacity) {
+            [self removeIdentifier:[_identifiers objectAtIndex:0]];
+            _stats.dropped++;
+        }
+
+        if ([_identifiers count] > 0)
+            MSDLog(@" [OFFLINE QUEUE] %d PENDING QUERIES", (int) [_identifiers count]);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_path release_stub];
+    _path = nil;
+    [_identifiers release_stub];
+    _identifiers = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (NSUInteger)maxAttempts {
+    @synchronized(self) {
+        return _maxAttempts;
+    }
+}
+
+- (void)setMaxAttempts:(NSUInteger)maxAttempts {
+    @synchronized(self) {
+        _maxAttempts = maxAttempts;
+    }
+}
+
+- (NSUInteger)count {
+    @synchronized(self) {
+        return [_identifiers count];
+    }
+}
+
+- (NSTimeInterval)oldestAge {
+    NSString *oldest = nil;
+    @synchronized(self) {
+        if ([_identifiers count] > 0) oldest = [[[_identifiers objectAtIndex:0] retain_stub] autorelease_stub];
+    }
+    if (oldest == nil) return 0;
+
+    NSTimeInterval queuedAt = [oldest longLongValue] / 1000.0;
+    NSTimeInterval age = [[NSDate date] timeIntervalSince1970] - queuedAt;
+    return (age > 0) ? age : 0;
+}
+
+- (MSOfflineQueueStats)stats {
+    @synchronized(self) {
+        return _stats;
+    }
+}
+
+#if MS_IPHONE_OS_REQUIREMENTS
+- (MSQueuedQuery *)push:(MSImage *)qry error:(NSError **)error {
+    // The API does not need more pixels than its minimum size
+    int w = 0, h = 0;
+    NSData *gray = [qry grayDataWithLongEdge:MS_IMG_MIN_SIZE width:&w height:&h];
+    if (gray == nil) {
+        if (error != nil) *error = [NSError errorWithDomain:@"moodstocks-sdk" code:MS_ERROR userInfo:nil];
+        return nil;
+    }
+
+    uLongf length = compressBound((uLong) [gray length]);
+    NSMutableData *file = [NSMutableData dataWithLength:sizeof(MSQueuedHeader) + length];
+    uint8_t *bytes = (uint8_t *) [file mutableBytes];
+    if (compress2(bytes + sizeof(MSQueuedHeader), &length,
+                  (const Bytef *) [gray bytes], (uLong) [gray length], Z_BEST_SPEED) != Z_OK) {
+        if (error != nil) *error = [NSError errorWithDomain:@"moodstocks-sdk" code:MS_ERROR userInfo:nil];
+        return nil;
+    }
+
+    NSTimeInterval now = [[NSDate date] timeIntervalSince1970];
+    MSQueuedHeader header;
+    header.magic = MS_QUEUE_MAGIC;
+    header.attempts = 0;
+    header.width = w;
+    header.height = h;
+    header.orientation = [qry orientation];
+    header.length = (uint32_t) length;
+    header.timestamp = now;
+    memcpy(bytes, &header, sizeof(header));
+    [file setLength:sizeof(MSQueuedHeader) + length];
+
+    MSQueuedQuery *query = nil;
+    @synchronized(self) {
+        NSString *identifier = [NSString stringWithFormat:@"%013llu-%04u",
+                                (unsigned long long) (now * 1000), (unsigned) (_seq++ % 10000)];
+        if ([file writeToFile:[self pathForIdentifier:identifier] atomically:YES]) {
+            [_identifiers addObject:identifier];
+            _stats.queued++;
+            while ([_identifiers count] > _capacity) {
+                MSDLog(@" [OFFLINE QUEUE] FULL: DROPPING %@", [_identifiers objectAtIndex:0]);
+                [self removeIdentifier:[_identifiers objectAtIndex:0]];
+                _stats.dropped++;
+            }
+            query = [[[MSQueuedQuery alloc] initWithIdentifier:identifier
+                                                     timestamp:now
+                                                      attempts:0
+                                                         image:nil] autorelease_stub];
+        }
+    }
+
+    if (query == nil && error != nil)
+        *error = [NSError errorWithDomain:@"moodstocks-sdk" code:MS_ERROR userInfo:nil];
+    return query;
+}
+#endif
+
+- (NSArray *)identifiers {
+    @synchronized(self) {
+        return [NSArray arrayWithArray:_identifiers];
+    }
+}
+
+- (MSQueuedQuery *)queryWithIdentifier:(NSString *)identifier {
+    NSData *file = nil;
+    @synchronized(self) {
+        if (![_identifiers containsObject:identifier]) return nil;
+        file = [NSData dataWithContentsOfFile:[self pathForIdentifier:identifier]];
+    }
+
+    MSQueuedHeader header;
+    BOOL valid = ([file length] >= sizeof(header));
+    if (valid) {
+        memcpy(&header, [file bytes], sizeof(header));
+        valid = (header.magic == MS_QUEUE_MAGIC &&
+                 header.width > 0 && header.height > 0 &&
+                 header.length == [file length] - sizeof(header));
+    }
+
+    MSImage *image = nil;
+    if (valid) {
+        uLongf length = (uLongf) header.width * header.height;
+        NSMutableData *gray = [NSMutableData dataWithLength:length];
+        if (uncompress((Bytef *) [gray mutableBytes], &length,
+                       (const Bytef *) [file bytes] + sizeof(header), header.length) == Z_OK &&
+            length == [gray length]) {
+            MSPlane plane = { [gray bytes], header.width, header.height, header.width, MS_PIX_FMT_GRAY8 };
+            image = [[[MSImage alloc] initWithPlane:&plane orientation:header.orientation] autorelease_stub];
+        }
+    }
+
+    if (image == nil || [image image] == NULL) {
+        // Nothing can be done with a corrupt query
+        MSDLog(@" [OFFLINE QUEUE] CORRUPT QUERY: DROPPING %@", identifier);
+        @synchronized(self) {
+            if ([_identifiers containsObject:identifier]) {
+                [self removeIdentifier:identifier];
+                _stats.dropped++;
+            }
+        }
+        return nil;
+    }
+
+    return [[[MSQueuedQuery alloc] initWithIdentifier:identifier
+                                            timestamp:header.timestamp
+                                             attempts:header.attempts
+                                                image:image] autorelease_stub];
+}
+
+- (void)remove:(MSQueuedQuery *)query {
+    @synchronized(self) {
+        if (![_identifiers containsObject:[query identifier]]) return;
+        [self removeIdentifier:[query identifier]];
+        _stats.delivered++;
+    }
+}
+
+- (BOOL)fail:(MSQueuedQuery *)query drop:(BOOL)drop {
+    @synchronized(self) {
+        NSString *identifier = [query identifier];
+        if (![_identifiers containsObject:identifier]) return NO;
+
+        _stats.retries++;
+        uint32_t attempts = (uint32_t) [query attempts] + 1;
+        [query setAttempts:attempts];
+
+        if (drop && attempts >= _maxAttempts) {
+            MSDLog(@" [OFFLINE QUEUE] TOO MANY ATTEMPTS: DROPPING %@", identifier);
+            [self removeIdentifier:identifier];
+            _stats.dropped++;
+            return YES;
+        }
+
+        // Only the attempts counter of the header has to be updated
+        FILE *fp = fopen([[self pathForIdentifier:identifier] fileSystemRepresentation], "r+b");
+        if (fp != NULL) {
+            if (fseek(fp, offsetof(MSQueuedHeader, attempts), SEEK_SET) == 0)
+                fwrite(&attempts, sizeof(attempts), 1, fp);
+            fclose(fp);
+        }
+        return NO;
+    }
+}
+
+- (void)clear {
+    @synchronized(self) {
+        while ([_identifiers count] > 0) {
+            [self removeIdentifier:[_identifiers objectAtIndex:0]];
+            _stats.dropped++;
+        }
+    }
+}
+
+#pragma mark - Private
+
+- (NSString *)pathForIdentifier:(NSString *)identifier {
+    return [_path stringByAppendingPathComponent:[identifier stringByAppendingPathExtension:kMSQueuedQueryExtension]];
+}
+
+- (void)removeIdentifier:(NSString *)identifier {
+    unlink([[self pathForIdentifier:identifier] fileSystemRepresentation]);
+    [_identifiers removeObject:identifier];
+}
+
+@end
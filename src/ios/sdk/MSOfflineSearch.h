@@ -0,0 +1,69 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#import "MSAvailability.h"
+#import "MSScanner.h"
+
+/**
+ * Re-submission of the online searches saved into the offline queue
+ *
+ * The queued queries are searched on Moodstocks API in batches of `batchSize`
+ * concurrent requests, oldest first. A query is removed from the queue once
+ * searched (whether it matched or not). The operation stops at the first
+ * transient failure (e.g. still no connection) while the queries failing for
+ * another reason are dropped after too many attempts (see `MSOfflineQueue`).
+ *
+ * Only the queries queued when the operation starts are re-submitted.
+ */
+@interface MSOfflineSearch : NSOperation {
+    MSScanner *_scanner;
+    MSApiToken *_token;
+    NSUInteger _batchSize;
+#if __has_feature(objc_arc_weak)
+    id<MSScannerDelegate> __weak _delegate;
+#elif __has_feature(objc_arc)
+    id<MSScannerDelegate> __unsafe_unretained _delegate;
+#else
+    id<MSScannerDelegate> _delegate;
+#endif
+}
+
+- (id)initWithScanner:(MSScanner *)scanner;
+
+/**
+ * Number of queries searched concurrently
+ *
+ * Default: 2.
+ */
+@property (nonatomic, assign) NSUInteger batchSize;
+
+#if __has_feature(objc_arc_weak)
+@property (nonatomic, weak) id<MSScannerDelegate> delegate;
+#elif __has_feature(objc_arc)
+@property (nonatomic, unsafe_unretained) id<MSScannerDelegate> delegate;
+#else
+@property (nonatomic, assign) id<MSScannerDelegate> delegate;
+#endif
+
+@end
@@ -0,0 +1,176 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#import "MSOfflineSearch.h"
+#import "MSOfflineQueue.h"
+#import "MSDebug.h"
+#import "MSObjC.h"
+
+#include <libkern/OSAtomic.h>
+
+/** Default number of queries searched concurrently */
+#define MS_OFFLINE_SEARCH_BATCH 2
+
+static BOOL msoffline_is_transient(ms_errcode ecode) {
+    switch (ecode) {
+        case MS_BUSY:
+        case MS_NOCONN:
+        case MS_TIMEOUT:
+        case MS_SLOWCONN:
+        case MS_UNAVAIL:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+@interface MSOfflineSearch ()
+- (void)didSearchQuery:(MSQueuedQuery *)query withResult:(MSResult *)result error:(NSError *)error;
+@end
+
+@implementation MSOfflineSearch
+
+@synthesize batchSize = _batchSize;
+@synthesize delegate = _delegate;
+
+- (id)initWithScanner:(MSScanner *)scanner {
+    self = [super init];
+    if (self) {
+        _scanner = scanner;
+        _token = [[MSApiToken alloc] init];
+        _batchSize = MS_OFFLINE_SEARCH_BATCH;
+        _delegate = nil;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    _scanner = nil;
+    [_token release_stub];
+    _token = nil;
+    _delegate = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (void)cancel {
+    // NOTE: only abort the re-submissions, not the other searches of the shared client
+    [_token cancel];
+
+    [super cancel];
+}
+
+- (void)main {
+#if __has_feature(objc_arc)
+    @autoreleasepool {
+#else
+    NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
+#endif
+
+#if MS_SDK_REQUIREMENTS
+    MSOfflineQueue *queue = [_scanner offlineQueue];
+    NSArray *identifiers = [queue identifiers];
+    NSUInteger count = [identifiers count];
+    NSUInteger batch = (_batchSize > 0) ? _batchSize : 1;
+    __block BOOL offline = NO;
+    __block BOOL aborted = NO;
+    __block int delivered = 0;
+
+    for (NSUInteger i = 0; i < count && !offline && !aborted && ![self isCancelled]; i += batch) {
+        size_t n = (count - i < batch) ? count - i : batch;
+        dispatch_apply(n, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t k) {
+#if __has_feature(objc_arc)
+            @autoreleasepool {
+#else
+            NSAutoreleasePool *itemPool = [[NSAutoreleasePool alloc] init];
+#endif
+            MSQueuedQuery *query = [queue queryWithIdentifier:[identifiers objectAtIndex:i + k]];
+            NSError *err = nil;
+            MSResult *result = nil;
+            if (query != nil) result = [[_scanner apiClient] search:[query image] token:_token error:&err];
+
+            if (query == nil) {
+                // Already gone (or corrupt): nothing to re-submit
+            }
+            else if ([self isCancelled] || (err != nil && ([err code] < 0 || [err code] == MS_ABORT))) {
+                // Cancelled (this flush or the whole client): this is not a
+                // failed attempt so leave the query as is, and stop there
+                aborted = YES;
+            }
+            else if (err == nil) {
+                [queue remove:query];
+                [self didSearchQuery:query withResult:result error:nil];
+                OSAtomicIncrement32((volatile int32_t *) &delivered);
+            }
+            else if (msoffline_is_transient((ms_errcode) [err code])) {
+                [queue fail:query drop:NO];
+                offline = YES;
+            }
+            else if ([queue fail:query drop:YES]) {
+                [self didSearchQuery:query withResult:nil error:err];
+            }
+#if __has_feature(objc_arc)
+            }
+#else
+            [itemPool release];
+#endif
+        });
+    }
+
+    MSDLog(@" [OFFLINE QUEUE] RE-SUBMITTED %d/%d QUERIES (%d LEFT)",
+           delivered, (int) count, (int) [queue count]);
+#endif
+
+#if __has_feature(objc_arc)
+    } /* end of @autoreleasepool block */
+#else
+    [pool release];
+#endif
+}
+
+#pragma mark - Private
+
+- (void)didSearchQuery:(MSQueuedQuery *)query withResult:(MSResult *)result error:(NSError *)error {
+    [query retain_stub];
+    [result retain_stub];
+    [error retain_stub];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        SEL sel = @selector(scanner:didSearchQueuedQuery:withResult:error:);
+        if ([_delegate respondsToSelector:sel])
+            [_delegate scanner:_scanner didSearchQueuedQuery:query withResult:result error:error];
+
+        for (id<MSScannerDelegate> extra in [_scanner offlineDelegates]) {
+            if ([extra respondsToSelector:sel] && extra != _delegate)
+                [extra scanner:_scanner didSearchQueuedQuery:query withResult:result error:error];
+        }
+
+        [query release_stub];
+        [result release_stub];
+        [error release_stub];
+    });
+}
+
+@end
@@ -0,0 +1,110 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#import <Foundation/Foundation.h>
+
+#import "MSImage.h"
+
+/** Patch width in thumbnail pixels */
+#define MS_TRACKER_PATCH_WIDTH  (MS_THUMB_WIDTH / 2)
+/** Patch height in thumbnail pixels */
+#define MS_TRACKER_PATCH_HEIGHT (MS_THUMB_HEIGHT / 2)
+
+/**
+ * Quadrilateral in normalized coordinates (i.e. within [0, 1]) relative to the
+ * camera frame as delivered by the sensor (see `-[MSImage imageWithRegion:levels:]`)
+ *
+ * Corners are listed clockwise from the top-left one.
+ */
+typedef struct {
+    float x[4];
+    float y[4];
+} MSQuad;
+
+/** Outcome of tracking a frame */
+typedef enum {
+    MS_TRACK_LOST = 0,      /* the patch could not be found with enough confidence */
+    MS_TRACK_OK,            /* the patch has been found */
+    MS_TRACK_VERIFY         /* the patch has been found but a full verification is due */
+} MSTrackState;
+
+/**
+ * Frame-to-frame patch tracker
+ *
+ * It follows a patch of the image thumbnail (see `-[MSImage thumbnail]`) across
+ * frames by normalized cross-correlation over a small search window around its
+ * last position. This is orders of magnitude cheaper than a match or a decode,
+ * so a result found on a frame can be confirmed on the following ones by the
+ * tracker and only verified every `verifyInterval` frames, or as soon as the
+ * tracking confidence drops below `minConfidence`.
+ *
+ * The patch is the central quarter of the frame (where the scanned object is
+ * expected to be) when tracking starts, and is refreshed on each verification.
+ *
+ * NOTE: the tracker only follows translations, so `quad` is a rectangle.
+ */
+@interface MSPatchTracker : NSObject {
+    uint8_t _patch[MS_TRACKER_PATCH_WIDTH * MS_TRACKER_PATCH_HEIGHT];
+    BOOL _tracking;
+    int _x;
+    int _y;
+    float _confidence;
+    int _frames;
+    int _verifyInterval;
+    int _radius;
+    float _minConfidence;
+}
+
+/** Flag indicating whether a patch is being tracked */
+@property (nonatomic, readonly, getter = isTracking) BOOL tracking;
+/** Correlation score of the last tracked frame (within [-1, 1]) */
+@property (nonatomic, readonly) float confidence;
+/** Current position of the patch */
+@property (nonatomic, readonly) MSQuad quad;
+/** Number of tracked frames after which a verification is due (default: 10) */
+@property (nonatomic, assign) int verifyInterval;
+/** Search window radius in thumbnail pixels (default: 3) */
+@property (nonatomic, assign) int radius;
+/** Correlation score below which the patch is lost (default: 0.8) */
+@property (nonatomic, assign) float minConfidence;
+
+/**
+ * Start tracking a patch of the given image
+ *
+ * The patch is taken at its current position if already tracking (i.e. after
+ * a successful verification), at the center of the image otherwise.
+ */
+- (BOOL)startWithImage:(MSImage *)img;
+
+/**
+ * Find the patch into the given image
+ */
+- (MSTrackState)track:(MSImage *)img;
+
+/**
+ * Stop tracking
+ */
+- (void)stop;
+
+@end
@@ -0,0 +1,129 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#import "MSPatchTracker.h"
+#import "MSImageProc.h"
+
+/** Default number of tracked frames between two verifications */
+#define MS_TRACKER_VERIFY_INTERVAL 10
+/** Default search window radius in thumbnail pixels */
+#define MS_TRACKER_RADIUS 3
+/** Default correlation score below which the patch is lost */
+#define MS_TRACKER_MIN_CONFIDENCE 0.8f
+
+@implementation MSPatchTracker
+
+@synthesize tracking = _tracking;
+@synthesize confidence = _confidence;
+@dynamic quad;
+@synthesize verifyInterval = _verifyInterval;
+@synthesize radius = _radius;
+@synthesize minConfidence = _minConfidence;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        _tracking = NO;
+        _x = 0;
+        _y = 0;
+        _confidence = 0;
+        _frames = 0;
+        _verifyInterval = MS_TRACKER_VERIFY_INTERVAL;
+        _radius = MS_TRACKER_RADIUS;
+        _minConfidence = MS_TRACKER_MIN_CONFIDENCE;
+    }
+    return self;
+}
+
+- (MSQuad)quad {
+    const float x0 = (float) _x / MS_THUMB_WIDTH;
+    const float y0 = (float) _y / MS_THUMB_HEIGHT;
+    const float x1 = (float) (_x + MS_TRACKER_PATCH_WIDTH) / MS_THUMB_WIDTH;
+    const float y1 = (float) (_y + MS_TRACKER_PATCH_HEIGHT) / MS_THUMB_HEIGHT;
+    MSQuad quad = { { x0, x1, x1, x0 }, { y0, y0, y1, y1 } };
+    return quad;
+}
+
+- (BOOL)startWithImage:(MSImage *)img {
+    const uint8_t *thumb = [img thumbnail];
+    if (thumb == NULL) {
+        [self stop];
+        return NO;
+    }
+
+    if (!_tracking) {
+        _x = (MS_THUMB_WIDTH - MS_TRACKER_PATCH_WIDTH) / 2;
+        _y = (MS_THUMB_HEIGHT - MS_TRACKER_PATCH_HEIGHT) / 2;
+    }
+    for (int j = 0; j < MS_TRACKER_PATCH_HEIGHT; j++) {
+        memcpy(_patch + j * MS_TRACKER_PATCH_WIDTH,
+               thumb + (_y + j) * MS_THUMB_WIDTH + _x,
+               MS_TRACKER_PATCH_WIDTH);
+    }
+
+    _tracking = YES;
+    _confidence = 1;
+    _frames = 0;
+    return YES;
+}
+
+- (MSTrackState)track:(MSImage *)img {
+    const uint8_t *thumb = [img thumbnail];
+    if (!_tracking || thumb == NULL) return MS_TRACK_LOST;
+
+    // Exhaustive search over the window: it is only a few dozen positions
+    float best = -1;
+    int bx = _x, by = _y;
+    for (int y = _y - _radius; y <= _y + _radius; y++) {
+        if (y < 0 || y > MS_THUMB_HEIGHT - MS_TRACKER_PATCH_HEIGHT) continue;
+        for (int x = _x - _radius; x <= _x + _radius; x++) {
+            if (x < 0 || x > MS_THUMB_WIDTH - MS_TRACKER_PATCH_WIDTH) continue;
+            float score = MSGrayNCC(thumb, MS_THUMB_WIDTH, x, y,
+                                    _patch, MS_TRACKER_PATCH_WIDTH, MS_TRACKER_PATCH_HEIGHT);
+            if (score > best) {
+                best = score;
+                bx = x;
+                by = y;
+            }
+        }
+    }
+
+    _confidence = best;
+    if (best < _minConfidence) {
+        [self stop];
+        return MS_TRACK_LOST;
+    }
+
+    _x = bx;
+    _y = by;
+    _frames++;
+    return (_frames >= _verifyInterval) ? MS_TRACK_VERIFY : MS_TRACK_OK;
+}
+
+- (void)stop {
+    _tracking = NO;
+    _frames = 0;
+}
+
+@end
@@ -35,6 +35,18 @@
  */
 typedef ms_result_type MSResultType;
 
+/**
+ * Counters of the results storage shared by all the `MSResult` objects
+ */
+typedef struct {
+    int64_t live;       /* number of distinct results currently stored */
+    int64_t created;    /* number of results stored (i.e. copies of SDK results) */
+    int64_t reused;     /* number of results that shared an already stored one */
+} MSResultStorageStats;
+
+/** Interned result (see `MSResult`) */
+typedef struct MSResultEntry MSResultEntry;
+
 /**
  * Structure holding the result of a scan
  * It is composed of:
@@ -45,17 +57,40 @@ typedef ms_result_type MSResultType;
  *    or `MS_RESULT_TYPE_EAN13`
  *  - raw QR Code data (i.e. *unparsed*) when type is `MS_RESULT_TYPE_QRCODE`
  *    or `MS_RESULT_TYPE_DMTX`
+ *
+ * Results are immutable and interned: all the results with the same type and
+ * value share the same storage, hashed once when it is created. Comparing two
+ * results is thus a pointer comparison, and copying one is a retain.
  */
 @interface MSResult : NSObject <NSCopying> {
-    ms_result_t *_result;
+    MSResultEntry *_entry;
 }
 
 @property (nonatomic, readonly) ms_result_t *handle;
 
+/**
+ * 64-bit hash of the type and value, computed once per distinct result
+ */
+@property (nonatomic, readonly) uint64_t hash64;
+
 - (id)init;
 - (id)initWithBytes:(const void *)bytes length:(NSUInteger)length type:(MSResultType)type;
 - (id)initWithResult:(const ms_result_t *)result;
 
+/**
+ * Return `ref` if it holds the same type and value as `result`, or a new
+ * result otherwise
+ *
+ * This avoids allocating a result when the same one keeps being found, e.g.
+ * while a barcode stays in the field of view.
+ */
++ (MSResult *)resultWithResult:(const ms_result_t *)result like:(MSResult *)ref;
+
+/**
+ * Return the counters of the results storage
+ */
++ (MSResultStorageStats)storageStats;
+
 /**
  * Return the result as a string with UTF-8 encoding
  * Use `getData` if you intend to create a string with another
@@ -93,7 +128,7 @@ typedef ms_result_type MSResultType;
 - (BOOL)isEqualToResult:(MSResult *)result;
 
 /**
- * Clone this result
+ * Clone this result, i.e. return it retained since it is immutable
  */
 - (id)copyWithZone:(NSZone *)zone;
 @end
@@ -25,14 +25,119 @@
 #import "MSAvailability.h"
 #import "MSObjC.h"
 
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of buckets of the results storage (a power of 2) */
+#define MS_RESULT_BUCKETS 256
+
+struct MSResultEntry {
+    MSResultEntry *next;
+    uint64_t hash;
+    int32_t refs;
+    ms_result_t *result;
+};
+
+#if MS_SDK_REQUIREMENTS
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static MSResultEntry *gBuckets[MS_RESULT_BUCKETS];
+static MSResultStorageStats gStats;
+
+// 64-bit FNV-1a hash of the value followed by the type
+static uint64_t ms_result_hash(const char *bytes, int length, ms_result_type type) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t) bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= (uint32_t) type;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+static BOOL ms_result_entry_equals(const MSResultEntry *entry, uint64_t hash,
+                                   const char *bytes, int length, ms_result_type type) {
+    if (entry->hash != hash || ms_result_get_type(entry->result) != type) return NO;
+    const char *data = NULL;
+    int size = 0;
+    ms_result_get_data(entry->result, &data, &size);
+    return (size == length && memcmp(data, bytes, length) == 0) ? YES : NO;
+}
+
+// Take a reference on the entry holding the given value, which is created
+// (by duplicating `source` if any) if there is none yet
+static MSResultEntry *ms_result_intern(const char *bytes, int length, ms_result_type type,
+                                       const ms_result_t *source) {
+    uint64_t hash = ms_result_hash(bytes, length, type);
+    MSResultEntry **bucket = &gBuckets[hash & (MS_RESULT_BUCKETS - 1)];
+
+    pthread_mutex_lock(&gLock);
+    MSResultEntry *entry = *bucket;
+    while (entry != NULL && !ms_result_entry_equals(entry, hash, bytes, length, type))
+        entry = entry->next;
+
+    if (entry != NULL) {
+        entry->refs++;
+        gStats.reused++;
+    }
+    else {
+        entry = (MSResultEntry *) calloc(1, sizeof(MSResultEntry));
+        ms_errcode ecode = MS_ERROR;
+        if (entry != NULL) {
+            if (source != NULL)
+                ecode = ms_result_dup(source, &entry->result);
+            else
+                ecode = ms_result_new(bytes, length, type, &entry->result);
+        }
+        if (ecode == MS_SUCCESS) {
+            entry->hash = hash;
+            entry->refs = 1;
+            entry->next = *bucket;
+            *bucket = entry;
+            gStats.created++;
+            gStats.live++;
+        }
+        else {
+            free(entry);
+            entry = NULL;
+        }
+    }
+    pthread_mutex_unlock(&gLock);
+
+    return entry;
+}
+
+// Drop a reference on the entry, which is freed along with the last one
+static void ms_result_release(MSResultEntry *entry) {
+    pthread_mutex_lock(&gLock);
+    if (--entry->refs == 0) {
+        MSResultEntry **link = &gBuckets[entry->hash & (MS_RESULT_BUCKETS - 1)];
+        while (*link != entry) link = &(*link)->next;
+        *link = entry->next;
+        gStats.live--;
+    }
+    else {
+        entry = NULL;
+    }
+    pthread_mutex_unlock(&gLock);
+
+    if (entry != NULL) {
+        ms_result_del(entry->result);
+        free(entry);
+    }
+}
+#endif
+
 @implementation MSResult
 
-@synthesize handle = _result;
+@dynamic handle;
+@dynamic hash64;
 
 - (id)init {
     self = [super init];
     if (self) {
-        _result = NULL;
+        _entry = NULL;
     }
     return self;
 }
@@ -41,7 +146,7 @@
     self = [self init];
 #if MS_SDK_REQUIREMENTS
     if (self) {
-        ms_result_new(bytes, length, type, &_result);
+        _entry = ms_result_intern((const char *) bytes, (int) length, type, NULL);
     }
 #endif
     return self;
@@ -51,19 +156,55 @@
     self = [self init];
 #if MS_SDK_REQUIREMENTS
     if (self) {
-        ms_result_dup(result, &_result);
+        const char *bytes = NULL;
+        int length = 0;
+        ms_result_get_data(result, &bytes, &length);
+        _entry = ms_result_intern(bytes, length, ms_result_get_type(result), result);
     }
 #endif
     return self;
 }
 
++ (MSResult *)resultWithResult:(const ms_result_t *)result like:(MSResult *)ref {
+#if MS_SDK_REQUIREMENTS
+    if (ref != nil && ref->_entry != NULL) {
+        const char *bytes = NULL;
+        int length = 0;
+        ms_result_get_data(result, &bytes, &length);
+        ms_result_type type = ms_result_get_type(result);
+        if (ms_result_entry_equals(ref->_entry, ms_result_hash(bytes, length, type), bytes, length, type))
+            return [[ref retain_stub] autorelease_stub];
+    }
+#endif
+    return [[[MSResult alloc] initWithResult:result] autorelease_stub];
+}
+
++ (MSResultStorageStats)storageStats {
+    MSResultStorageStats stats;
+    memset(&stats, 0, sizeof(stats));
+#if MS_SDK_REQUIREMENTS
+    pthread_mutex_lock(&gLock);
+    stats = gStats;
+    pthread_mutex_unlock(&gLock);
+#endif
+    return stats;
+}
+
+- (ms_result_t *)handle {
+    return (_entry != NULL) ? _entry->result : NULL;
+}
+
+- (uint64_t)hash64 {
+    return (_entry != NULL) ? _entry->hash : 0;
+}
+
 - (NSString *)getValue {
     NSString *str = nil;
 #if MS_SDK_REQUIREMENTS
-    if (_result) {
+    if (_entry) {
         const char *bytes = NULL;
         int length;
-        ms_result_get_data(_result, &bytes, &length);
+        ms_result_get_data(_entry->result, &bytes, &length);
         str = [[[NSString alloc] initWithBytes:bytes
                                         length:length
                                       encoding:NSUTF8StringEncoding] autorelease_stub];
@@ -75,10 +216,10 @@
 - (NSData *)getData {
     NSData *data = nil;
 #if MS_SDK_REQUIREMENTS
-    if (_result) {
+    if (_entry) {
         const char *bytes = NULL;
         int length;
-        ms_result_get_data(_result, &bytes, &length);
+        ms_result_get_data(_entry->result, &bytes, &length);
         data = [[[NSData alloc] initWithBytes:bytes length:length] autorelease_stub];
     }
 #endif
@@ -88,9 +229,9 @@
 - (NSData *)getDataFromBase64URL {
     NSData *data = nil;
 #if MS_SDK_REQUIREMENTS
-    if (_result) {
+    if (_entry) {
         int length;
-        char *bytes = ms_result_get_data_b64(_result, &length);
+        char *bytes = ms_result_get_data_b64(_entry->result, &length);
         data = [[[NSData alloc] initWithBytes:bytes length:length] autorelease_stub];
         free(bytes);
     }
@@ -113,26 +254,34 @@
 - (MSResultType)getType {
     ms_result_type type = MS_RESULT_TYPE_NONE;
 #if MS_SDK_REQUIREMENTS
-    if (_result)
-        type = ms_result_get_type(_result);
+    if (_entry)
+        type = ms_result_get_type(_entry->result);
 #endif
     return type;
 }
 
 - (BOOL)isEqualToResult:(MSResult *)result {
-#if MS_SDK_REQUIREMENTS
-    return ms_result_cmp(_result, [result handle]) == 0 ? YES : NO;
-#else
-    return NO;
-#endif
+    // NOTE: equal results share the same entry
+    if (result == nil) return NO;
+    if (result == self) return YES;
+    return (_entry != NULL && _entry == result->_entry) ? YES : NO;
+}
+
+- (BOOL)isEqual:(id)object {
+    if (![object isKindOfClass:[MSResult class]]) return NO;
+    return [self isEqualToResult:(MSResult *) object];
+}
+
+- (NSUInteger)hash {
+    return (NSUInteger) [self hash64];
 }
 
 - (void)dealloc {
 #if MS_SDK_REQUIREMENTS
-    if (_result)
-        ms_result_del(_result);
+    if (_entry)
+        ms_result_release(_entry);
 #endif
-    _result = NULL;
+    _entry = NULL;
 
 #if ! __has_feature(objc_arc)
     [super dealloc];
@@ -140,17 +289,7 @@
 }
 
 - (id)copyWithZone:(NSZone *)zone {
-#if MS_SDK_REQUIREMENTS
-    const char *bytes = NULL;
-    int length;
-    ms_result_get_data(_result, &bytes, &length);
-    ms_result_type type = ms_result_get_type(_result);
-    return [[MSResult allocWithZone:zone] initWithBytes:bytes
-                                                 length:length
-                                                   type:type];
-#else
-    return nil;
-#endif
+    return [self retain_stub];
 }
 
 @end
@@ -0,0 +1,103 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "MSImage.h"
+#import "MSResult.h"
+
+@class MSScanner;
+
+/**
+ * Usage counters of a result cache
+ */
+typedef struct {
+    NSUInteger lookups;     /* number of lookups */
+    NSUInteger hits;        /* number of lookups served by a cached result */
+    NSUInteger misses;      /* number of lookups without any close enough hash */
+    NSUInteger rejects;     /* number of lookups whose candidate failed the match */
+    NSUInteger evictions;   /* number of results evicted to make room */
+} MSResultCacheStats;
+
+/**
+ * Least-recently-used cache of image search results keyed by a perceptual
+ * hash (dHash) of the query thumbnail
+ *
+ * When a frame hashes close enough to a cached entry (see `threshold`), the
+ * cached result is confirmed with a match (`ms_scanner_match`) which is much
+ * cheaper than a full search. Only confirmed results are served so a hash
+ * collision never produces a wrong result.
+ *
+ * This class is thread safe.
+ */
+@interface MSResultCache : NSObject {
+    uint64_t *_hashes;
+    NSMutableArray *_results;
+    NSUInteger _capacity;
+    int _threshold;
+    MSResultCacheStats _stats;
+}
+
+/** Maximum number of cached results */
+@property (readonly) NSUInteger capacity;
+
+/**
+ * Largest Hamming distance between two hashes for a cached result to be
+ * considered (default: 10 bits out of 64)
+ */
+@property (assign) int threshold;
+
+/** Usage counters */
+@property (readonly) MSResultCacheStats stats;
+
+/**
+ * Create a cache holding up to `capacity` results
+ */
+- (id)initWithCapacity:(NSUInteger)capacity;
+
+/**
+ * Look for a cached result matching the query image
+ *
+ * Returns `nil` if there is none, or if the query has no thumbnail.
+ */
+- (MSResult *)resultForImage:(MSImage *)qry scanner:(MSScanner *)scanner;
+
+/**
+ * Record the result found for the query image
+ *
+ * Only image results are cached: barcodes are cheaper to decode again.
+ */
+- (void)addResult:(MSResult *)result forImage:(MSImage *)qry;
+
+/**
+ * Evict all cached results (e.g. once the database has been synchronized: see
+ * `-[MSScanner generation]`)
+ */
+- (void)removeAllResults;
+
+/**
+ * Reset the usage counters
+ */
+- (void)resetStats;
+
+@end
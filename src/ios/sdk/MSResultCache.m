@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSResultCache.h"
+#import "MSScanner.h"
+#import "MSImageProc.h"
+#import "MSObjC.h"
+
+#include <stdlib.h>
+
+/** Default Hamming distance threshold */
+#define MS_RESULT_CACHE_THRESHOLD 10
+
+@interface MSResultCache ()
+- (void)touch:(NSUInteger)index;
+@end
+
+@implementation MSResultCache
+
+@synthesize capacity = _capacity;
+@dynamic threshold;
+@dynamic stats;
+
+- (id)initWithCapacity:(NSUInteger)capacity {
+    self = [super init];
+    if (self) {
+        _capacity = capacity;
+        _threshold = MS_RESULT_CACHE_THRESHOLD;
+        _hashes = (uint64_t *) calloc(capacity > 0 ? capacity : 1, sizeof(uint64_t));
+        _results = [[NSMutableArray alloc] initWithCapacity:capacity];
+        memset(&_stats, 0, sizeof(_stats));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(_hashes);
+    _hashes = NULL;
+
+    [_results release_stub];
+    _results = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (int)threshold {
+    @synchronized(self) {
+        return _threshold;
+    }
+}
+
+- (void)setThreshold:(int)threshold {
+    @synchronized(self) {
+        _threshold = threshold;
+    }
+}
+
+- (MSResultCacheStats)stats {
+    @synchronized(self) {
+        return _stats;
+    }
+}
+
+- (void)resetStats {
+    @synchronized(self) {
+        memset(&_stats, 0, sizeof(_stats));
+    }
+}
+
+- (MSResult *)resultForImage:(MSImage *)qry scanner:(MSScanner *)scanner {
+    const uint8_t *thumb = [qry thumbnail];
+    if (thumb == NULL) return nil;
+    uint64_t hash = MSGrayDHash(thumb, MS_THUMB_WIDTH, MS_THUMB_HEIGHT);
+
+    // Pick the closest entry
+    MSResult *candidate = nil;
+    @synchronized(self) {
+        _stats.lookups++;
+        int best = _threshold + 1;
+        for (NSUInteger i = 0; i < [_results count]; i++) {
+            int d = MSHammingDistance(hash, _hashes[i]);
+            if (d < best) {
+                best = d;
+                candidate = [_results objectAtIndex:i];
+            }
+        }
+        if (candidate == nil) {
+            _stats.misses++;
+            return nil;
+        }
+        [[candidate retain_stub] autorelease_stub];
+    }
+
+    // Confirm it outside of the lock: matching is way slower than hashing
+    BOOL match = [scanner match:qry ref:candidate error:nil];
+
+    @synchronized(self) {
+        if (!match) {
+            _stats.rejects++;
+            return nil;
+        }
+        _stats.hits++;
+        NSUInteger index = [_results indexOfObjectIdenticalTo:candidate];
+        if (index != NSNotFound) {
+            // Refresh the hash so that the entry follows the viewpoint
+            _hashes[index] = hash;
+            [self touch:index];
+        }
+    }
+    return candidate;
+}
+
+- (void)addResult:(MSResult *)result forImage:(MSImage *)qry {
+    if (result == nil || [result getType] != MS_RESULT_TYPE_IMAGE || _capacity == 0) return;
+    const uint8_t *thumb = [qry thumbnail];
+    if (thumb == NULL) return;
+    uint64_t hash = MSGrayDHash(thumb, MS_THUMB_WIDTH, MS_THUMB_HEIGHT);
+
+    @synchronized(self) {
+        NSUInteger index = NSNotFound;
+        for (NSUInteger i = 0; i < [_results count]; i++) {
+            if ([[_results objectAtIndex:i] isEqualToResult:result]) {
+                index = i;
+                break;
+            }
+        }
+
+        if (index == NSNotFound) {
+            if ([_results count] == _capacity) {
+                [_results removeLastObject];
+                _stats.evictions++;
+            }
+            index = [_results count];
+            MSResult *copy = [result copy];
+            [_results addObject:copy];
+            [copy release_stub];
+        }
+        _hashes[index] = hash;
+        [self touch:index];
+    }
+}
+
+- (void)removeAllResults {
+    @synchronized(self) {
+        [_results removeAllObjects];
+    }
+}
+
+#pragma mark - Private
+
+// Move an entry to the front (most recently used), the lock must be held
+- (void)touch:(NSUInteger)index {
+    if (index == 0) return;
+    uint64_t hash = _hashes[index];
+    memmove(_hashes + 1, _hashes, index * sizeof(uint64_t));
+    _hashes[0] = hash;
+
+    MSResult *result = [[_results objectAtIndex:index] retain_stub];
+    [_results removeObjectAtIndex:index];
+    [_results insertObject:result atIndex:0];
+    [result release_stub];
+}
+
+@end
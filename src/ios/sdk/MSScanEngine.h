@@ -0,0 +1,184 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "MSAvailability.h"
+#import "MSScanner.h"
+#import "MSImage.h"
+#import "MSResult.h"
+#import "MSResultCache.h"
+#import "MSPatchTracker.h"
+
+/**
+ * Counters accumulated by a scan engine since its creation (or since the last
+ * call to `resetStats`)
+ *
+ * They make it possible to measure how much work the result lock avoids:
+ * every frame served by the lock costs a single match (or decode) instead of
+ * a full search followed by a decode, and every frame served by the tracker
+ * costs neither.
+ */
+typedef struct {
+    NSUInteger frames;      /* number of scanned frames */
+    NSUInteger searches;    /* number of `ms_scanner_search` calls */
+    NSUInteger matches;     /* number of `ms_scanner_match` calls */
+    NSUInteger decodes;     /* number of `ms_scanner_decode` calls */
+    NSUInteger decodeHits;  /* number of `ms_scanner_decode` calls that found a barcode */
+    NSUInteger locks;       /* number of frames served by the result lock */
+    NSUInteger tracks;      /* number of locked frames confirmed by the tracker (no match / decode) */
+    NSUInteger cacheHits;   /* number of frames served by the result cache */
+    NSUInteger busy;        /* number of frames skipped while the database is being written */
+    double totalTime;       /* cumulated scan time in seconds */
+    double searchTime;      /* cumulated `ms_scanner_search` time in seconds */
+    double matchTime;       /* cumulated `ms_scanner_match` time in seconds */
+    double decodeTime;      /* cumulated `ms_scanner_decode` time in seconds */
+} MSScanEngineStats;
+
+/**
+ * Frame-by-frame scanning logic
+ *
+ * The engine holds the result lock: once something has been found, the
+ * following frames are only checked against it (with a match for images,
+ * or a decode restricted to the same format for 2D barcodes) until it is
+ * lost twice in a row. Otherwise a full image search is performed, followed
+ * by barcode decoding.
+ *
+ * While a result is locked, the tracker (see `tracker`) follows it from frame
+ * to frame so that the match (or decode) is only performed from time to time
+ * to verify it.
+ *
+ * It does not depend on the video capture: any `MSImage` can be fed to it,
+ * whatever its origin (camera frame, still image, etc).
+ *
+ * When both image search and barcode decoding are requested, they can run in
+ * parallel on two threads (see `concurrent`). The results are then merged
+ * with the same priority as the sequential mode: the image search result
+ * always wins over the barcode one.
+ *
+ * NOTE: an engine is not thread safe, it must be used from a single queue.
+ */
+@interface MSScanEngine : NSObject {
+    MSScanner *_scanner;
+    MSResult *_result;
+    int _losts;
+    BOOL _concurrent;
+    BOOL _multiDecode;
+    NSArray *_codes;
+    MSResultCache *_cache;
+    NSUInteger _generation;
+    MSPatchTracker *_tracker;
+#if MS_IPHONE_OS_REQUIREMENTS
+    CGRect _decodeRegion;
+    int _decodeLevels;
+#endif
+    MSScanEngineStats _stats;
+}
+
+/** The current locked result, if any */
+@property (nonatomic, readonly) MSResult *result;
+/**
+ * Run image search and barcode decoding in parallel
+ *
+ * Default: YES on multi-core devices, NO otherwise.
+ */
+@property (nonatomic, assign) BOOL concurrent;
+/**
+ * Decode every barcode of the frame instead of the first one found (see
+ * `-[MSScanner multiDecode:formats:error:]`), e.g. to read several labels at
+ * once in a continuous scan
+ *
+ * The first code is returned as the scan result and all of them are available
+ * through `codes`.
+ *
+ * Default: NO.
+ */
+@property (nonatomic, assign) BOOL multiDecode;
+/**
+ * Barcodes decoded from the last scanned frame when `multiDecode` is set
+ * (nil otherwise, or if the frame has not been decoded)
+ */
+@property (nonatomic, readonly) NSArray *codes;
+/**
+ * Cache of recent image results checked before any full image search
+ *
+ * It is kept across `reset` so that pointing the camera again at something
+ * found a few seconds ago only costs a match. It is emptied whenever the
+ * database generation changes. Set it to `nil` to disable it.
+ *
+ * Default: a cache of 8 results.
+ */
+@property (nonatomic, retain) MSResultCache *cache;
+/**
+ * Tracker confirming the locked result between two verifications
+ *
+ * Its `quad` tells where the locked result currently is while it is tracking.
+ * Set it to `nil` to verify every locked frame.
+ *
+ * Default: a tracker verifying every 10 frames.
+ */
+@property (nonatomic, retain) MSPatchTracker *tracker;
+#if MS_IPHONE_OS_REQUIREMENTS
+/**
+ * Region of interest used for barcode decoding
+ *
+ * It is expressed in normalized coordinates relative to the camera frame (see
+ * `-[MSImage imageWithRegion:levels:]`). Image search always uses the full
+ * frame. If the region is too small to build an image out of it, the full
+ * frame is decoded.
+ *
+ * Default: {0, 0, 1, 1} (i.e. the full frame).
+ */
+@property (nonatomic, assign) CGRect decodeRegion;
+
+/**
+ * Number of extra pyramid levels used for barcode decoding
+ *
+ * When greater than 0, the region of interest is first decoded at the
+ * coarsest level (i.e. downscaled `decodeLevels` times by 2), then at finer
+ * levels until a barcode is found. Levels too small for the SDK are skipped.
+ *
+ * Default: 0 (i.e. the region of interest is only decoded at full scale).
+ */
+@property (nonatomic, assign) int decodeLevels;
+#endif
+/** Scan counters */
+@property (nonatomic, readonly) MSScanEngineStats stats;
+
+- (id)initWithScanner:(MSScanner *)scanner;
+
+/**
+ * Scan a query image among the given options (see `MSResultType`)
+ *
+ * Returns the result found, or `nil` if there is no result or if an error
+ * occurred.
+ */
+- (MSResult *)scan:(MSImage *)qry options:(int)options error:(NSError **)error;
+
+/** Release the result lock */
+- (void)reset;
+
+/** Reset the scan counters */
+- (void)resetStats;
+
+@end
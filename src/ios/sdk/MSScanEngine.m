@@ -0,0 +1,316 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSScanEngine.h"
+#import "MSObjC.h"
+
+/** Number of consecutive "no match" required to release the result lock */
+#define MS_SCAN_ENGINE_MAX_LOSTS 2
+/** Number of results held by the default result cache */
+#define MS_SCAN_ENGINE_CACHE_CAPACITY 8
+/** Result types that can be followed by the tracker */
+#define MS_SCAN_ENGINE_TRACKED_TYPES (MS_RESULT_TYPE_IMAGE | MS_RESULT_TYPE_QRCODE | MS_RESULT_TYPE_DMTX)
+
+@interface MSScanEngine ()
+- (MSResult *)decode:(MSImage *)qry formats:(int)formats error:(NSError **)error;
+@end
+
+@implementation MSScanEngine
+
+@synthesize result = _result;
+@synthesize concurrent = _concurrent;
+@synthesize multiDecode = _multiDecode;
+@synthesize codes = _codes;
+@synthesize cache = _cache;
+@synthesize tracker = _tracker;
+#if MS_IPHONE_OS_REQUIREMENTS
+@synthesize decodeRegion = _decodeRegion;
+@synthesize decodeLevels = _decodeLevels;
+#endif
+@synthesize stats = _stats;
+
+- (id)initWithScanner:(MSScanner *)scanner {
+    self = [super init];
+    if (self) {
+        _scanner = scanner;
+        _result = nil;
+        _losts = 0;
+        _concurrent = ([[NSProcessInfo processInfo] activeProcessorCount] > 1);
+        _multiDecode = NO;
+        _codes = nil;
+        _cache = [[MSResultCache alloc] initWithCapacity:MS_SCAN_ENGINE_CACHE_CAPACITY];
+        _generation = [scanner generation];
+        _tracker = [[MSPatchTracker alloc] init];
+#if MS_IPHONE_OS_REQUIREMENTS
+        _decodeRegion = CGRectMake(0, 0, 1, 1);
+        _decodeLevels = 0;
+#endif
+        memset(&_stats, 0, sizeof(_stats));
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_result release_stub];
+    _result = nil;
+    [_codes release_stub];
+    _codes = nil;
+    [_cache release_stub];
+    _cache = nil;
+    [_tracker release_stub];
+    _tracker = nil;
+    _scanner = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (void)reset {
+    [_result release_stub];
+    _result = nil;
+    _losts = 0;
+    [_tracker stop];
+}
+
+- (void)resetStats {
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+- (MSResult *)scan:(MSImage *)qry options:(int)options error:(NSError **)error {
+    MSResult *result = nil;
+#if MS_SDK_REQUIREMENTS
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    _stats.frames++;
+    [_codes release_stub];
+    _codes = nil;
+
+    // Do not wait for an exclusive access (e.g. a database swap) to complete:
+    // the frame would be outdated by then
+    if ([_scanner isWriting]) {
+        _stats.busy++;
+        return nil;
+    }
+
+    BOOL lock = NO;
+    BOOL verified = NO;
+    if (_result != nil && _losts < MS_SCAN_ENGINE_MAX_LOSTS) {
+        int _resultType = [_result getType];
+        NSInteger found = 0;
+        BOOL verify = YES;
+        if ([_tracker isTracking] && [_tracker track:qry] == MS_TRACK_OK) {
+            // The tracker still follows the result: no need to verify it yet
+            _stats.tracks++;
+            found = 1;
+            verify = NO;
+        }
+        else if (_resultType == MS_RESULT_TYPE_IMAGE) {
+            CFAbsoluteTime t = CFAbsoluteTimeGetCurrent();
+            _stats.matches++;
+            found = [_scanner match:qry ref:_result error:nil] ? 1 : -1;
+            _stats.matchTime += CFAbsoluteTimeGetCurrent() - t;
+        }
+        else if (_resultType == MS_RESULT_TYPE_QRCODE) {
+            MSResult *qr = [self decode:qry formats:MS_RESULT_TYPE_QRCODE error:nil];
+            found = [qr isEqualToResult:_result] ? 1 : -1;
+        }
+        else if (_resultType == MS_RESULT_TYPE_DMTX) {
+            MSResult *dmtx = [self decode:qry formats:MS_RESULT_TYPE_DMTX error:nil];
+            found = [dmtx isEqualToResult:_result] ? 1 : -1;
+        }
+
+        if (found == 1) {
+            // The current frame matches with the previous result
+            lock = YES;
+            _losts = 0;
+            verified = verify;
+        }
+        else if (found == -1) {
+            [_tracker stop];
+            // The current frame looks different so release the lock
+            // if there is enough consecutive "no match"
+            _losts++;
+            lock = (_losts >= MS_SCAN_ENGINE_MAX_LOSTS) ? NO : YES;
+        }
+    }
+
+    if (lock) {
+        // Re-use the previous result and skip searching / decoding
+        // the current frame
+        _stats.locks++;
+        result = [[_result retain_stub] autorelease_stub];
+    }
+
+    // The cached results may refer to images removed by a synchronization
+    NSUInteger generation = [_scanner generation];
+    if (generation != _generation) {
+        _generation = generation;
+        [_cache removeAllResults];
+    }
+
+    if (result == nil && _cache != nil && (options & MS_RESULT_TYPE_IMAGE)) {
+        // A near-duplicate of a recent frame only needs a match
+        result = [_cache resultForImage:qry scanner:_scanner];
+        if (result != nil) {
+            _stats.cacheHits++;
+            _losts = 0;
+            verified = YES;
+        }
+    }
+
+    if (result == nil) {
+        BOOL search = !!(options & MS_RESULT_TYPE_IMAGE);
+        BOOL parallel = search && _concurrent && (options & ~MS_RESULT_TYPE_IMAGE);
+
+        // -------------------------------------------------
+        // Image search (in the background if parallel)
+        // -------------------------------------------------
+        __block MSResult *searched = nil;
+        __block NSError *searchErr = nil;
+        __block CFTimeInterval searchTime = 0;
+        void (^searchBlock)(void) = ^{
+            CFAbsoluteTime t = CFAbsoluteTimeGetCurrent();
+            NSError *e = nil;
+            MSResult *r = [_scanner search:qry error:&e];
+            searched = [r retain_stub];
+            searchErr = [e retain_stub];
+            searchTime = CFAbsoluteTimeGetCurrent() - t;
+        };
+
+        dispatch_group_t group = NULL;
+        if (parallel) {
+            group = dispatch_group_create();
+            dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), searchBlock);
+        }
+        else if (search) {
+            searchBlock();
+        }
+
+        // -------------------------------------------------
+        // Barcode decoding (skipped if the search succeeded)
+        // -------------------------------------------------
+        MSResult *decoded = nil;
+        NSError *decodeErr = nil;
+        if (parallel || (searched == nil && (searchErr == nil || [searchErr code] == MS_EMPTY))) {
+            if (_multiDecode && (options & ~MS_RESULT_TYPE_IMAGE)) {
+                // NOTE: the decodes it performs are counted by the scanner (see `multiDecodeStats`)
+                CFAbsoluteTime t = CFAbsoluteTimeGetCurrent();
+                _codes = [[_scanner multiDecode:qry formats:(options & ~MS_RESULT_TYPE_IMAGE) error:&decodeErr] retain_stub];
+                _stats.decodeTime += CFAbsoluteTimeGetCurrent() - t;
+                if ([_codes count] > 0) decoded = [_codes objectAtIndex:0];
+            }
+            else {
+                decoded = [self decode:qry formats:options error:&decodeErr];
+            }
+        }
+
+        if (group != NULL) {
+            dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+            dispatch_release(group);
+#endif
+        }
+        [searched autorelease_stub];
+        [searchErr autorelease_stub];
+        if (search) {
+            _stats.searches++;
+            _stats.searchTime += searchTime;
+        }
+
+        // -------------------------------------------------
+        // Merge: image search has priority over barcodes
+        // -------------------------------------------------
+        NSError *err = nil;
+        if (searchErr != nil && [searchErr code] != MS_EMPTY)
+            err = searchErr;
+        else if (searched != nil) {
+            result = searched;
+            [_cache addResult:searched forImage:qry];
+        }
+        else if (decodeErr != nil)
+            err = decodeErr;
+        else
+            result = decoded;
+
+        if (err != nil) {
+            if (error) *error = err;
+            _stats.totalTime += CFAbsoluteTimeGetCurrent() - start;
+            return nil;
+        }
+        if (result != nil) {
+            _losts = 0;
+            verified = YES;
+        }
+    }
+
+    if (![result isEqualToResult:_result]) {
+        [_result release_stub];
+        _result = [result retain_stub];
+        [_tracker stop];
+    }
+
+    // (Re)anchor the tracker on each frame where the result has been verified
+    if (verified && _result != nil && ([_result getType] & MS_SCAN_ENGINE_TRACKED_TYPES))
+        [_tracker startWithImage:qry];
+
+    _stats.totalTime += CFAbsoluteTimeGetCurrent() - start;
+#endif
+    return result;
+}
+
+#pragma mark - Private
+
+- (MSResult *)decode:(MSImage *)qry formats:(int)formats error:(NSError **)error {
+    MSResult *result = nil;
+#if MS_SDK_REQUIREMENTS
+    // Decoding candidates, from the coarsest to the finest
+    NSMutableArray *candidates = [NSMutableArray arrayWithCapacity:_decodeLevels + 1];
+    if (!CGRectEqualToRect(_decodeRegion, CGRectMake(0, 0, 1, 1)) || _decodeLevels > 0) {
+        for (int level = _decodeLevels; level >= 0; level--) {
+            MSImage *img = [qry imageWithRegion:_decodeRegion levels:level];
+            if (img != nil) [candidates addObject:img];
+        }
+    }
+    if ([candidates count] == 0) [candidates addObject:qry];
+
+    for (MSImage *img in candidates) {
+        CFAbsoluteTime t = CFAbsoluteTimeGetCurrent();
+        NSError *err = nil;
+        _stats.decodes++;
+        result = [_scanner decode:img formats:formats like:_result error:&err];
+        _stats.decodeTime += CFAbsoluteTimeGetCurrent() - t;
+
+        if (err != nil) {
+            if (error) *error = err;
+            return nil;
+        }
+        if (result != nil) {
+            _stats.decodeHits++;
+            break;
+        }
+    }
+#endif
+    return result;
+}
+
+@end
@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "MSImage.h"
+
+/** Work to be done on a frame, as decided by the scheduler */
+typedef enum {
+    MS_SCHED_SKIP = 0,      /* do not scan the frame at all */
+    MS_SCHED_DECODE,        /* only decode barcodes (no image search) */
+    MS_SCHED_SCAN           /* perform a full scan */
+} MSScheduleDecision;
+
+/**
+ * Scheduler counters
+ */
+typedef struct {
+    NSUInteger frames;      /* number of frames submitted to the scheduler */
+    NSUInteger skipped;     /* number of frames skipped */
+    NSUInteger decodeOnly;  /* number of frames restricted to barcode decoding */
+    NSUInteger scanned;     /* number of frames fully scanned */
+    double searchLatency;   /* moving average of the image search latency in seconds */
+} MSScanSchedulerStats;
+
+/**
+ * Adaptive frame scheduler
+ *
+ * The scheduler decides for each frame whether it is worth scanning. It relies
+ * on two cheap measures:
+ * - the difference between the frame thumbnail and the one of the last
+ *   scanned frame: a frame that looks the same as a frame that has already
+ *   been scanned without success is skipped,
+ * - an exponential moving average of the image search latency: image search
+ *   is restricted to a CPU budget (i.e. a number of seconds of search per
+ *   second), and frames that exceed it are only decoded.
+ *
+ * A full scan is forced at least every `maxSkipInterval` seconds so that slow
+ * changes (e.g. focus, lighting) are eventually taken into account.
+ *
+ * NOTE: a scheduler is not thread safe, it must be used from a single queue.
+ */
+@interface MSScanScheduler : NSObject {
+    uint8_t _lastThumb[MS_THUMB_SIZE];
+    BOOL _hasLastThumb;
+    BOOL _lastFound;
+    CFAbsoluteTime _lastScan;
+    CFAbsoluteTime _lastRefill;
+    double _tokens;
+    double _searchBudget;
+    int _motionThreshold;
+    NSTimeInterval _maxSkipInterval;
+    MSScanSchedulerStats _stats;
+}
+
+/**
+ * Maximum number of seconds spent in image search per second
+ *
+ * Default: 0.5. Use 1 (or more) to never restrict image search.
+ */
+@property (nonatomic, assign) double searchBudget;
+
+/**
+ * Mean absolute thumbnail difference (in gray levels) below which a frame is
+ * considered unchanged
+ *
+ * Default: 4. Use 0 to never skip frames.
+ */
+@property (nonatomic, assign) int motionThreshold;
+
+/**
+ * Maximum time between two full scans of an unchanged scene, in seconds
+ *
+ * Default: 1.
+ */
+@property (nonatomic, assign) NSTimeInterval maxSkipInterval;
+
+/** Scheduler counters */
+@property (nonatomic, readonly) MSScanSchedulerStats stats;
+
+/**
+ * Decide what to do with a frame to be scanned among the given options
+ *
+ * `locked` indicates whether the scan engine currently holds a result, in
+ * which case the frame is always scanned (the lock check is cheap).
+ */
+- (MSScheduleDecision)decisionForFrame:(MSImage *)qry options:(int)options locked:(BOOL)locked;
+
+/**
+ * Report the outcome of a frame scan
+ *
+ * `searchTime` is the time spent in image search (0 if no search was
+ * performed) and `found` whether a result was found.
+ */
+- (void)didScanFrame:(MSImage *)qry searchTime:(NSTimeInterval)searchTime found:(BOOL)found;
+
+/** Forget the last scanned frame */
+- (void)reset;
+
+@end
@@ -0,0 +1,109 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSScanScheduler.h"
+#import "MSImageProc.h"
+#import "MSObjC.h"
+
+/** Smoothing factor of the search latency moving average */
+#define MS_SCHED_EMA_ALPHA 0.2
+/** Initial guess of the search latency in seconds */
+#define MS_SCHED_DEFAULT_LATENCY 0.1
+
+@implementation MSScanScheduler
+
+@synthesize searchBudget = _searchBudget;
+@synthesize motionThreshold = _motionThreshold;
+@synthesize maxSkipInterval = _maxSkipInterval;
+@synthesize stats = _stats;
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        _searchBudget = 0.5;
+        _motionThreshold = 4;
+        _maxSkipInterval = 1;
+        memset(&_stats, 0, sizeof(_stats));
+        _stats.searchLatency = MS_SCHED_DEFAULT_LATENCY;
+        _tokens = _searchBudget;
+        _lastRefill = CFAbsoluteTimeGetCurrent();
+        [self reset];
+    }
+    return self;
+}
+
+- (void)reset {
+    _hasLastThumb = NO;
+    _lastFound = NO;
+    _lastScan = 0;
+}
+
+- (MSScheduleDecision)decisionForFrame:(MSImage *)qry options:(int)options locked:(BOOL)locked {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    _stats.frames++;
+
+    // Refill the search budget (token bucket holding at most one second worth
+    // of search time)
+    _tokens += (now - _lastRefill) * _searchBudget;
+    if (_tokens > _searchBudget) _tokens = _searchBudget;
+    _lastRefill = now;
+
+    MSScheduleDecision decision = MS_SCHED_SCAN;
+    const uint8_t *thumb = [qry thumbnail];
+
+    if (!locked && !_lastFound && _hasLastThumb && thumb != NULL &&
+        now - _lastScan < _maxSkipInterval &&
+        MSGrayMeanAbsDiff(thumb, _lastThumb, MS_THUMB_SIZE) < _motionThreshold) {
+        // Nothing was found on a frame that looks the same
+        decision = MS_SCHED_SKIP;
+    }
+    else if (!locked && (options & MS_RESULT_TYPE_IMAGE) && _tokens < _stats.searchLatency) {
+        // Out of search budget: fall back on barcodes, if any
+        decision = (options & ~MS_RESULT_TYPE_IMAGE) ? MS_SCHED_DECODE : MS_SCHED_SKIP;
+    }
+
+    switch (decision) {
+        case MS_SCHED_SKIP:   _stats.skipped++;    break;
+        case MS_SCHED_DECODE: _stats.decodeOnly++; break;
+        case MS_SCHED_SCAN:   _stats.scanned++;    break;
+    }
+
+    return decision;
+}
+
+- (void)didScanFrame:(MSImage *)qry searchTime:(NSTimeInterval)searchTime found:(BOOL)found {
+    const uint8_t *thumb = [qry thumbnail];
+    if (thumb != NULL) {
+        memcpy(_lastThumb, thumb, MS_THUMB_SIZE);
+        _hasLastThumb = YES;
+    }
+    _lastFound = found;
+    _lastScan = CFAbsoluteTimeGetCurrent();
+
+    if (searchTime > 0) {
+        _tokens -= searchTime;
+        _stats.searchLatency += MS_SCHED_EMA_ALPHA * (searchTime - _stats.searchLatency);
+    }
+}
+
+@end
@@ -22,14 +22,46 @@
  */
 
 #import <Foundation/Foundation.h>
+#import <SystemConfiguration/SystemConfiguration.h>
+
+#include <pthread.h>
 
 #include "moodstocks_sdk.h"
 
 #import "MSImage.h"
 #import "MSResult.h"
+#import "MSSyncJournal.h"
+#import "MSSyncChangelog.h"
+#import "MSIdIndex.h"
+#import "MSApiClient.h"
+#import "MSOfflineQueue.h"
 
 @protocol MSScannerDelegate;
 
+/**
+ * Database access counters accumulated by the scanner since its creation
+ *
+ * Shared accesses (search, match, decode, info, API handle creation) run
+ * concurrently with each other while exclusive ones (open, close, database
+ * swap) wait for them to complete and block any new access in the meantime.
+ */
+typedef struct {
+    int64_t shared;         /* number of shared accesses */
+    int64_t exclusive;      /* number of exclusive accesses */
+    int64_t contended;      /* number of accesses that had to wait for the lock */
+    int64_t waitTime;       /* cumulated lock waiting time in microseconds */
+} MSScannerAccessStats;
+
+/**
+ * Multi-code decoding counters accumulated by the scanner since its creation
+ */
+typedef struct {
+    int64_t frames;         /* number of query images processed */
+    int64_t regions;        /* number of candidate areas located */
+    int64_t decodes;        /* number of decodes performed */
+    int64_t codes;          /* number of distinct codes found */
+} MSScannerMultiDecodeStats;
+
 /**
  * Wrapper around Moodstocks SDK scanner object
  *
@@ -38,13 +70,40 @@
  * - offline search over the local database of image records,
  * - remote search on Moodstocks API,
  * - 1D/2D barcode decoding.
+ *
+ * It is safe to use from several threads: searches, matches and decodes run
+ * concurrently with each other while open and close get an exclusive access
+ * to the database. A synchronization works on a shadow copy of the database
+ * and only needs an exclusive access to swap it in once done.
  */
 @interface MSScanner : NSObject {
     NSString *_dbPath;
+    NSString *_shadowPath;
+    NSString *_backupPath;
+    NSString *_indexPath;
+    MSIdIndex *_index;
+    dispatch_queue_t _indexQueue;
+    NSString *_key;
+    NSString *_secret;
     ms_scanner_t *_scanner;
+    volatile int32_t _generation;
     NSOperationQueue *_syncQueue;
+    NSTimeInterval _syncProgressInterval;
+    MSSyncJournal *_syncJournal;
+    BOOL _opened;
     NSMutableArray *_syncDelegates;
     NSOperationQueue *_searchQueue;
+    MSApiClient *_apiClient;
+    NSOperationQueue *_batchQueue;
+    MSOfflineQueue *_offlineQueue;
+    NSOperationQueue *_flushQueue;
+    NSMutableArray *_offlineDelegates;
+    SCNetworkReachabilityRef _reachability;
+    pthread_rwlock_t _lock;
+    volatile int32_t _writers;
+    BOOL _exclusive;
+    MSScannerAccessStats _access;
+    MSScannerMultiDecodeStats _multi;
 }
 
 /**
@@ -59,6 +118,76 @@
  */
 @property (nonatomic, readonly) NSMutableArray *syncDelegates;
 
+/**
+ * Database generation, i.e. number of synchronizations swapped in since the
+ * scanner has been created
+ *
+ * It can be used to tell whether a result has been found on an outdated
+ * database.
+ */
+@property (nonatomic, readonly) NSUInteger generation;
+
+/**
+ * Index of the image identifiers recorded into the database (`nil` if it is
+ * not available yet)
+ *
+ * It is (re)built in the background when opening the scanner if missing or
+ * outdated, or if a corrupt page is found, and right after each
+ * synchronization. Builds are serialized on a single queue.
+ */
+@property (readonly) MSIdIndex *idIndex;
+
+/**
+ * Smallest delay in seconds between two `didSyncWithProgress:total:` notifications
+ *
+ * The progress is coalesced in between (see `MSSync`). Default: one per display frame.
+ */
+@property (nonatomic, assign) NSTimeInterval syncProgressInterval;
+
+/**
+ * Checkpoint of the last synchronization (see `resumeSyncWithDelegate:`)
+ */
+@property (nonatomic, readonly) MSSyncJournal *syncJournal;
+
+/**
+ * Client used to perform online searches (see `apiSearch:withDelegate:`)
+ */
+@property (nonatomic, readonly) MSApiClient *apiClient;
+
+/**
+ * Queue of the online searches that failed for lack of connectivity
+ *
+ * The queued queries are re-submitted in the background as soon as Moodstocks
+ * API becomes reachable again (and each time the application becomes active)
+ * while the scanner is open. See `flushOfflineQueueWithDelegate:`.
+ */
+@property (nonatomic, readonly) MSOfflineQueue *offlineQueue;
+
+/**
+ * Array of non-retained objects that receive messages about the re-submitted
+ * queued queries (see `syncDelegates`)
+ */
+@property (nonatomic, readonly) NSMutableArray *offlineDelegates;
+
+/**
+ * Flag indicating whether an exclusive access (e.g. a synchronization) is pending
+ * or in progress
+ *
+ * Any shared access performed meanwhile blocks until it is over, so real-time
+ * callers (e.g. camera frames) can check it to skip work instead of waiting.
+ */
+@property (nonatomic, readonly, getter = isWriting) BOOL writing;
+
+/**
+ * Database access counters
+ */
+@property (nonatomic, readonly) MSScannerAccessStats accessStats;
+
+/**
+ * Multi-code decoding counters (see `multiDecode:formats:error:`)
+ */
+@property (nonatomic, readonly) MSScannerMultiDecodeStats multiDecodeStats;
+
 /**
  * Obtain the singleton instance
  */
@@ -86,6 +215,42 @@
  */
 - (void)syncWithDelegate:(id<MSScannerDelegate>)delegate;
 
+/**
+ * Synchronize the database right away (blocking)
+ *
+ * The synchronization runs on a shadow copy of the database file (`ms.db.shadow`)
+ * opened by a second scanner object, so searches keep running on the current
+ * database in the meantime. Once the shadow database is synchronized and
+ * validated it is renamed over the current one, the scanner is reopened on it
+ * and the generation is incremented. The pending online requests are aborted
+ * (then retried) beforehand so that the swap does not wait for the network.
+ *
+ * The replaced database is kept as a backup (`ms.db.bak`): it is restored if the
+ * new database can't be opened, or if the database is found corrupt when
+ * opening the scanner, instead of starting over from an empty database.
+ *
+ * A shadow database left by an interrupted synchronization is re-used when the
+ * synchronization is resumed (see `syncJournal`). If it can't be opened it is
+ * made again from a fresh copy once, otherwise the synchronization fails: the
+ * database is never synchronized in place.
+ *
+ * NOTE: this is used by `syncWithDelegate:` which should be preferred.
+ */
+- (BOOL)syncWithProgress:(ms_scanner_sync_cb)callback opaque:(void *)opq error:(NSError **)error;
+
+/**
+ * Resume the last synchronization if it did not complete
+ *
+ * Returns NO if there is nothing to resume (or if a sync is already pending).
+ * This is automatically done each time the application becomes active while
+ * the scanner is open: only the extra delegates (see `syncDelegates`) are then
+ * notified.
+ *
+ * Only the synchronizations interrupted by a transient error (e.g. no network)
+ * or a cancellation are resumed, and only until 12 attempts have been made.
+ */
+- (BOOL)resumeSyncWithDelegate:(id<MSScannerDelegate>)delegate;
+
 /**
  * Check if a sync is pending
  */
@@ -101,6 +266,23 @@
  */
 - (NSArray *)info:(NSError **)error;
 
+/**
+ * Get a page of the images identifiers found into the local database
+ *
+ * Identifiers are sorted in lexicographic (byte) order. Only the ones starting
+ * with `prefix` are considered (all of them if `nil`): the page starts at
+ * `offset` among them and holds up to `limit` identifiers. `total` (optional)
+ * receives the number of identifiers starting with `prefix`.
+ *
+ * The identifiers index (see `idIndex`) is used when available so that only the
+ * returned page is loaded. Otherwise all the identifiers are loaded (see `info:`).
+ */
+- (NSArray *)infoWithPrefix:(NSString *)prefix
+                     offset:(NSUInteger)offset
+                      limit:(NSUInteger)limit
+                      total:(NSUInteger *)total
+                      error:(NSError **)error;
+
 /**
  * Perform a remote image search on Moodstocks API
  *
@@ -113,6 +295,25 @@
  */
 - (void)apiSearch:(MSImage *)qry withDelegate:(id<MSScannerDelegate>)delegate;
 
+/**
+ * Perform an offline image search and a remote one concurrently
+ *
+ * The first match wins (see `-[MSApiClient hybridSearch:path:error:]`) and is
+ * notified through the same `MSScannerDelegate` protocol methods as `apiSearch:withDelegate:`.
+ */
+- (void)hybridSearch:(MSImage *)qry withDelegate:(id<MSScannerDelegate>)delegate;
+
+/**
+ * Re-submit the queued online searches (see `offlineQueue`)
+ *
+ * This method runs in the background so you can safely call it from the main thread.
+ * Returns NO if the queue is empty or if it is already being re-submitted.
+ *
+ * The delegate, along with the extra ones (see `offlineDelegates`), is notified
+ * through `scanner:didSearchQueuedQuery:withResult:error:`.
+ */
+- (BOOL)flushOfflineQueueWithDelegate:(id<MSScannerDelegate>)delegate;
+
 /**
  * Cancel any pending API search(es)
  */
@@ -123,6 +324,23 @@
  */
 - (MSResult *)search:(MSImage *)qry error:(NSError **)error;
 
+/**
+ * Performs offline image searches over a batch of query images (array of `MSImage`)
+ *
+ * This method runs in the background so you can safely call it from the main thread.
+ * The queries are spread over as many threads as there are active processors.
+ *
+ * Take care to implement the ad hoc `MSScannerDelegate` protocol methods since
+ * this method keeps its delegate notified: each result is streamed as soon as it
+ * is available, then the whole batch is reported in input order.
+ */
+- (void)searchBatch:(NSArray *)queries withDelegate:(id<MSScannerDelegate>)delegate;
+
+/**
+ * Cancel any pending batch search(es)
+ */
+- (void)cancelBatchSearch;
+
 /**
  * Matches a query image against a local database reference
  */
@@ -133,6 +351,41 @@
  */
 - (MSResult *)decode:(MSImage *)qry formats:(int)formats error:(NSError **)error;
 
+/**
+ * Same as `decode:formats:error:` except that `ref` itself is returned if the
+ * decoded barcode is the same (e.g. the result locked by a scanner session) so
+ * that no result is allocated
+ */
+- (MSResult *)decode:(MSImage *)qry formats:(int)formats like:(MSResult *)ref error:(NSError **)error;
+
+/**
+ * Performs barcode decoding over every area of the query image that looks like
+ * a barcode, among given formats, e.g. to read several labels at once
+ *
+ * The candidate areas are located in one pass over a downscaled gray copy of
+ * the camera frame (see `MSGrayCodeRegions`), then decoded in parallel. An area
+ * too small for the SDK is enlarged around its center, so it may also contain
+ * (and yield) a neighboring code. The whole image is decoded if no area is
+ * found or if it has not been created from a camera frame.
+ *
+ * Returns the distinct results (possibly none), from the most to the least
+ * textured area, or nil on error.
+ */
+- (NSArray *)multiDecode:(MSImage *)qry formats:(int)formats error:(NSError **)error;
+
+/**
+ * Acquire a shared (resp. exclusive) access to the internal scanner handle
+ *
+ * The scanner methods take care of it: this is only needed by code that
+ * works on `handle` directly. Each call must be balanced with `unlock`.
+ *
+ * NOTE: accesses are not re-entrant, do not call the scanner methods while
+ *       holding one of them
+ */
+- (void)lockShared;
+- (void)lockExclusive;
+- (void)unlock;
+
 @end
 
 /**
@@ -161,6 +414,12 @@
  */
 - (void)scannerDidSync:(MSScanner *)scanner;
 
+/**
+ * Dispatched when a synchronization is completed, right before `scannerDidSync:`,
+ * with the changes it brought to the local database
+ */
+- (void)scanner:(MSScanner *)scanner didSyncWithChangelog:(MSSyncChangelog *)changelog;
+
 /**
  * Dispatched when a synchronization failed
  */
@@ -182,4 +441,44 @@
  * Dispatched when an online search (aka API search) failed
  */
 - (void)scanner:(MSScanner *)scanner failedToSearchWithError:(NSError *)error;
+
+/**
+ * Dispatched when an online search failed for lack of connectivity and its query
+ * has been saved into the offline queue instead (see `offlineQueue`)
+ *
+ * NOTE: if this method is not implemented the failure is dispatched through
+ *       `scanner:failedToSearchWithError:` as usual (the query is queued anyway)
+ */
+- (void)scanner:(MSScanner *)scanner didQueueSearch:(MSQueuedQuery *)query;
+
+/**
+ * Dispatched each time a queued query has been re-submitted
+ *
+ * The result is `nil` in case of no match found. The error is only set if the
+ * query has been dropped after too many failed attempts.
+ */
+- (void)scanner:(MSScanner *)scanner didSearchQueuedQuery:(MSQueuedQuery *)query
+     withResult:(MSResult *)result
+          error:(NSError *)error;
+
+/**
+ * Dispatched each time a query of a batch search has been searched
+ *
+ * `index` specifies the position of the query within the batch. The result is `nil`
+ * in case of no match found or if an error occurred.
+ *
+ * NOTE: the items of a batch are searched in parallel so they are not
+ *       necessarily dispatched in input order
+ */
+- (void)scanner:(MSScanner *)scanner didSearchBatchItem:(NSUInteger)index
+     withResult:(MSResult *)result
+          error:(NSError *)error;
+
+/**
+ * Dispatched when a batch search is completed
+ *
+ * `results` and `errors` are in input order. They hold respectively the `MSResult`
+ * and the `NSError` of each query, or `NSNull` if there is none.
+ */
+- (void)scanner:(MSScanner *)scanner didSearchBatchWithResults:(NSArray *)results errors:(NSArray *)errors;
 @end
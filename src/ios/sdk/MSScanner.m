@@ -26,27 +26,85 @@
 #import "MSDebug.h"
 #import "MSSync.h"
 #import "MSApiSearch.h"
+#import "MSBatchSearch.h"
+#import "MSOfflineSearch.h"
+#import "MSTrace.h"
+#import "MSImagePool.h"
+#import "MSImageProc.h"
 #import "MSObjC.h"
 
+#include <libkern/OSAtomic.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 // Callbacks to create a non retaining array
 static const void *MSScannerRetainNoOp(CFAllocatorRef allocator, const void *value) { return value; }
 static void MSScannerNoOp(CFAllocatorRef allocator, const void *value) { }
 
 static MSScanner *gMSScanner   = nil;
 static NSString *kMSDBFilename = @"ms.db";
+static NSString *kMSSyncJournalFilename = @"ms.db.sync";
+static NSString *kMSShadowDBFilename = @"ms.db.shadow";
+static NSString *kMSBackupDBFilename = @"ms.db.bak";
+static NSString *kMSIdIndexFilename = @"ms.db.idx";
+static NSString *kMSOfflineQueueDirname = @"ms.db.queue";
+static const char *kMSApiHostname = "api.moodstocks.com";
+
+/** Number of warm API handles */
+#define MS_SCANNER_API_HANDLES 2
+/** Maximum number of online searches kept into the offline queue */
+#define MS_SCANNER_OFFLINE_QUEUE 20
+/** Maximum number of areas decoded by a multi-code decoding */
+#define MS_SCANNER_MULTI_DECODE_MAX 16
+/** Growth factor applied to an area too small to be decoded */
+#define MS_SCANNER_MULTI_DECODE_GROWTH 1.5
+/** Number of attempts (retries included) after which a pending sync is no longer resumed */
+#define MS_SCANNER_SYNC_MAX_ATTEMPTS 12
 
 @interface MSScanner ()
 
 #if MS_SDK_REQUIREMENTS
 - (void)applicationWillLeaveForeground:(void *)ignored;
+- (void)applicationDidBecomeActive:(void *)ignored;
+- (void)reachabilityChanged:(SCNetworkReachabilityFlags)flags;
+- (ms_scanner_t *)openShadow:(ms_errcode *)ecode;
+- (ms_errcode)swapShadow;
+- (void)loadIndex;
+- (void)loadIndexAsync;
 #endif
+- (void)lock:(BOOL)exclusive;
 
 @end
 
+#if MS_SDK_REQUIREMENTS
+static void MSScannerReachabilityCallback(SCNetworkReachabilityRef target,
+                                          SCNetworkReachabilityFlags flags,
+                                          void *info) {
+#if __has_feature(objc_arc)
+    MSScanner *scanner = (__bridge MSScanner *) info;
+#else
+    MSScanner *scanner = (MSScanner *) info;
+#endif
+    [scanner reachabilityChanged:flags];
+}
+#endif
+
 @implementation MSScanner
 
 @synthesize handle = _scanner;
 @synthesize syncDelegates = _syncDelegates;
+@synthesize syncJournal = _syncJournal;
+@synthesize syncProgressInterval = _syncProgressInterval;
+@dynamic generation;
+@dynamic idIndex;
+@synthesize apiClient = _apiClient;
+@synthesize offlineQueue = _offlineQueue;
+@synthesize offlineDelegates = _offlineDelegates;
+@dynamic writing;
+@dynamic accessStats;
+@dynamic multiDecodeStats;
 
 + (MSScanner *)sharedInstance {
     if (!gMSScanner) {
@@ -59,11 +117,31 @@ static NSString *kMSDBFilename = @"ms.db";
     self = [super init];
     if (self) {
         _scanner = NULL;
+        _key = nil;
+        _secret = nil;
+        _generation = 0;
+        pthread_rwlock_init(&_lock, NULL);
+        _writers = 0;
+        _exclusive = NO;
+        memset(&_access, 0, sizeof(_access));
+        memset(&_multi, 0, sizeof(_multi));
         
     // Build database path for later use
     NSArray *paths = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES);
     NSString *cachesPath = [paths objectAtIndex:0];
     _dbPath = [[cachesPath stringByAppendingPathComponent:kMSDBFilename] retain_stub];
+    _shadowPath = [[cachesPath stringByAppendingPathComponent:kMSShadowDBFilename] retain_stub];
+    _backupPath = [[cachesPath stringByAppendingPathComponent:kMSBackupDBFilename] retain_stub];
+    _indexPath = [[cachesPath stringByAppendingPathComponent:kMSIdIndexFilename] retain_stub];
+    _index = nil;
+    // Index builds are serialized since they write the same files
+    _indexQueue = dispatch_queue_create("moodstocks-id-index", DISPATCH_QUEUE_SERIAL);
+    dispatch_set_target_queue(_indexQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+    _syncJournal = [[MSSyncJournal alloc] initWithPath:[cachesPath stringByAppendingPathComponent:kMSSyncJournalFilename]];
+    _offlineQueue = [[MSOfflineQueue alloc] initWithPath:[cachesPath stringByAppendingPathComponent:kMSOfflineQueueDirname]
+                                                capacity:MS_SCANNER_OFFLINE_QUEUE];
+    _reachability = NULL;
+    _opened = NO;
 
 #if MS_SDK_REQUIREMENTS
 
@@ -84,9 +162,26 @@ static NSString *kMSDBFilename = @"ms.db";
                    selector:@selector(applicationWillLeaveForeground:)
                        name:UIApplicationWillTerminateNotification
                      object:nil];
+        [center addObserver:self
+                   selector:@selector(applicationDidBecomeActive:)
+                       name:UIApplicationDidBecomeActiveNotification
+                     object:nil];
+        
+        // Re-submit the queued searches as soon as the API is reachable again
+        _reachability = SCNetworkReachabilityCreateWithName(NULL, kMSApiHostname);
+        if (_reachability != NULL) {
+#if __has_feature(objc_arc)
+            SCNetworkReachabilityContext context = { 0, (__bridge void *) self, NULL, NULL, NULL };
+#else
+            SCNetworkReachabilityContext context = { 0, self, NULL, NULL, NULL };
+#endif
+            SCNetworkReachabilitySetCallback(_reachability, MSScannerReachabilityCallback, &context);
+            SCNetworkReachabilitySetDispatchQueue(_reachability, dispatch_get_main_queue());
+        }
         
 #endif
         _syncQueue = [[NSOperationQueue alloc] init];
+        _syncProgressInterval = MS_SYNC_PROGRESS_INTERVAL;
         CFArrayCallBacks callbacks = kCFTypeArrayCallBacks;
         callbacks.retain = MSScannerRetainNoOp;
         callbacks.release = MSScannerNoOp;
@@ -96,6 +191,15 @@ static NSString *kMSDBFilename = @"ms.db";
         _syncDelegates = (NSMutableArray *) CFArrayCreateMutable(nil, 0, &callbacks);
 #endif
         _searchQueue = [[NSOperationQueue alloc] init];
+        _apiClient = [[MSApiClient alloc] initWithScanner:self capacity:MS_SCANNER_API_HANDLES];
+        _batchQueue = [[NSOperationQueue alloc] init];
+        _flushQueue = [[NSOperationQueue alloc] init];
+        [_flushQueue setMaxConcurrentOperationCount:1];
+#if __has_feature(objc_arc)
+        _offlineDelegates = (NSMutableArray *) CFBridgingRelease(CFArrayCreateMutable(nil, 0, &callbacks));
+#else
+        _offlineDelegates = (NSMutableArray *) CFArrayCreateMutable(nil, 0, &callbacks);
+#endif
     }
     return self;
 }
@@ -103,14 +207,47 @@ static NSString *kMSDBFilename = @"ms.db";
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self];
 
+    if (_reachability != NULL) {
+        SCNetworkReachabilitySetDispatchQueue(_reachability, NULL);
+        CFRelease(_reachability);
+    }
+    _reachability = NULL;
+
 #if MS_SDK_REQUIREMENTS
     if (_scanner) ms_scanner_del(_scanner);
 #endif
     _scanner = NULL;
+    pthread_rwlock_destroy(&_lock);
     
     [_dbPath release_stub];
     _dbPath = nil;
     
+    [_shadowPath release_stub];
+    _shadowPath = nil;
+    
+    [_backupPath release_stub];
+    _backupPath = nil;
+    
+    [_indexPath release_stub];
+    _indexPath = nil;
+    
+    [_index release_stub];
+    _index = nil;
+    
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(_indexQueue);
+#endif
+    _indexQueue = NULL;
+    
+    [_key release_stub];
+    _key = nil;
+    
+    [_secret release_stub];
+    _secret = nil;
+    
+    [_syncJournal release_stub];
+    _syncJournal = nil;
+    
     [_syncQueue release_stub];
     _syncQueue = nil;
     
@@ -120,6 +257,21 @@ static NSString *kMSDBFilename = @"ms.db";
     [_searchQueue release_stub];
     _searchQueue = nil;
     
+    [_apiClient release_stub];
+    _apiClient = nil;
+    
+    [_batchQueue release_stub];
+    _batchQueue = nil;
+    
+    [_flushQueue release_stub];
+    _flushQueue = nil;
+    
+    [_offlineQueue release_stub];
+    _offlineQueue = nil;
+    
+    [_offlineDelegates release_stub];
+    _offlineDelegates = nil;
+    
 #if ! __has_feature(objc_arc)
     [super dealloc];
 #endif
@@ -132,11 +284,23 @@ static NSString *kMSDBFilename = @"ms.db";
     
 #if MS_SDK_REQUIREMENTS
     if (MSDeviceCompatibleWithSDK()) {
+        [self lockExclusive];
         ms_errcode ecode = ms_scanner_open(_scanner,
                                            [_dbPath UTF8String],
                                            [key UTF8String],
                                            [secret UTF8String]);
 
+        if (ecode == MS_CORRUPT && [[NSFileManager defaultManager] fileExistsAtPath:_backupPath]) {
+            // Restore the last good database: the next sync only has to catch up
+            MSDLog(@" [SCANNER] CORRUPT DATABASE: RESTORING THE BACKUP");
+            ms_scanner_close(_scanner);
+            rename([_backupPath fileSystemRepresentation], [_dbPath fileSystemRepresentation]);
+            ecode = ms_scanner_open(_scanner,
+                                    [_dbPath UTF8String],
+                                    [key UTF8String],
+                                    [secret UTF8String]);
+        }
+
         if (ecode == MS_CORRUPT) {
             ms_scanner_close(_scanner);
             ms_scanner_clean([_dbPath UTF8String]);
@@ -145,6 +309,19 @@ static NSString *kMSDBFilename = @"ms.db";
                                     [key UTF8String],
                                     [secret UTF8String]);
         }
+        [self unlock];
+        _opened = (ecode == MS_SUCCESS);
+        
+        // Keep the credentials to open the shadow database when syncing
+        if (_opened) {
+            [_key release_stub];
+            [_secret release_stub];
+            _key = [key copy];
+            _secret = [secret copy];
+        }
+        
+        // Listing the whole database may take a while: do not block the caller
+        if (_opened) [self loadIndexAsync];
 
         if (ecode != MS_SUCCESS) {
             err = YES;
@@ -168,7 +345,13 @@ static NSString *kMSDBFilename = @"ms.db";
     BOOL err = NO;
 
 #if MS_SDK_REQUIREMENTS
+    // NOTE: no API handle may outlive the scanner
+    [_apiClient drain];
+    [self lockExclusive];
     ms_errcode ecode = ms_scanner_close(_scanner);
+    [self unlock];
+    [_apiClient resume];
+    _opened = NO;
     if (ecode != MS_SUCCESS) {
         err = YES;
         if (error != nil) {
@@ -184,10 +367,81 @@ static NSString *kMSDBFilename = @"ms.db";
 #if MS_SDK_REQUIREMENTS
     MSSync *op = [[[MSSync alloc] initWithScanner:self] autorelease_stub];
     [op setDelegate:delegate];
+    [op setProgressInterval:_syncProgressInterval];
     [_syncQueue addOperation:op];
 #endif
 }
 
+- (BOOL)syncWithProgress:(ms_scanner_sync_cb)callback opaque:(void *)opq error:(NSError **)error {
+    BOOL err = NO;
+    
+#if MS_SDK_REQUIREMENTS
+    ms_errcode ecode = MS_SUCCESS;
+    ms_scanner_t *shadow = [self openShadow:&ecode];
+    if (shadow == NULL && ecode != MS_MISUSE) {
+        // The faulty shadow database has been removed: start over from a fresh copy
+        MSDLog(@" [SYNC] NO SHADOW DATABASE (%@): RETRYING", MSErrMsg(ecode));
+        shadow = [self openShadow:&ecode];
+    }
+    if (shadow != NULL) {
+        uint64_t t = MSTraceNow();
+        ecode = ms_scanner_sync2(shadow, callback, opq);
+        MSTraceRecord(MS_TRACE_SYNC, t);
+        
+        // Validate the shadow database before swapping it in
+        if (ecode == MS_SUCCESS) {
+            int cnt;
+            ecode = ms_scanner_info(shadow, &cnt, NULL);
+            if (ecode == MS_EMPTY) ecode = MS_SUCCESS;
+        }
+        
+        ms_scanner_close(shadow);
+        ms_scanner_del(shadow);
+        
+        if (ecode == MS_SUCCESS) {
+            t = MSTraceNow();
+            ecode = [self swapShadow];
+            MSTraceRecord(MS_TRACE_SWAP, t);
+        }
+        else if (ecode == MS_CORRUPT)
+            ms_scanner_clean([_shadowPath UTF8String]);
+    }
+    else {
+        // Syncing in place would block the searches for the whole download
+        MSDLog(@" [SYNC] NO SHADOW DATABASE (%@)", MSErrMsg(ecode));
+    }
+    
+    // The new index is needed right away (e.g. for the sync changelog)
+    if (ecode == MS_SUCCESS) {
+        dispatch_sync(_indexQueue, ^{
+            [self loadIndex];
+        });
+    }
+    
+    if (ecode != MS_SUCCESS) {
+        err = YES;
+        if (error != nil) {
+            *error = [NSError errorWithDomain:@"moodstocks-sdk" code:ecode userInfo:nil];
+        }
+    }
+#endif
+    
+    return !err;
+}
+
+- (BOOL)resumeSyncWithDelegate:(id<MSScannerDelegate>)delegate {
+    if (![_syncJournal isPending] || [self isSyncing]) return NO;
+    if ([_syncJournal attempts] >= MS_SCANNER_SYNC_MAX_ATTEMPTS) {
+        // Do not hit the network each time the app becomes active: the next
+        // explicit sync starts over
+        [_syncJournal abandon:[_syncJournal lastError]];
+        return NO;
+    }
+    MSDLog(@" [SYNC] RESUMING AFTER %d ATTEMPT(S)", (int) [_syncJournal attempts]);
+    [self syncWithDelegate:delegate];
+    return YES;
+}
+
 - (BOOL)isSyncing {
     return !!([_syncQueue operationCount] >= 1);
 }
@@ -196,7 +450,12 @@ static NSString *kMSDBFilename = @"ms.db";
     int cnt;
     
 #if MS_SDK_REQUIREMENTS
+    MSIdIndex *index = [self idIndex];
+    if (index != nil) return (NSInteger) [index count];
+    
+    [self lockShared];
     ms_errcode ecode = ms_scanner_info(_scanner, &cnt, NULL);
+    [self unlock];
     if (ecode != MS_SUCCESS && ecode != MS_EMPTY) {
         cnt = -1;
         if (error != nil) {
@@ -216,10 +475,12 @@ static NSString *kMSDBFilename = @"ms.db";
     NSMutableArray *ary = nil;
     
 #if MS_SDK_REQUIREMENTS
-    ary = [NSMutableArray arrayWithCapacity:[self count:nil]];
-    int cnt;
+    int cnt = 0;
     char **ids = NULL;
+    [self lockShared];
     ms_errcode ecode = ms_scanner_info(_scanner, &cnt, &ids);
+    [self unlock];
+    ary = [NSMutableArray arrayWithCapacity:cnt];
     if (ecode != MS_SUCCESS && ecode != MS_EMPTY) {
         if (error != nil) {
             *error = [NSError errorWithDomain:@"moodstocks-sdk" code:ecode userInfo:nil];
@@ -239,12 +500,79 @@ static NSString *kMSDBFilename = @"ms.db";
 }
 
 
+- (NSArray *)infoWithPrefix:(NSString *)prefix
+                     offset:(NSUInteger)offset
+                      limit:(NSUInteger)limit
+                      total:(NSUInteger *)total
+                      error:(NSError **)error {
+    NSMutableArray *ary = nil;
+    
+#if MS_SDK_REQUIREMENTS
+    const char *pfx = (prefix != nil) ? [prefix UTF8String] : "";
+    size_t len = strlen(pfx);
+    
+    MSIdIndex *index = [self idIndex];
+    if (index != nil) {
+        // The matching identifiers lie between `prefix` and `prefix` followed by
+        // 0xFF (a byte never found in UTF-8 strings)
+        char *upper = (char *) malloc(len + 2);
+        memcpy(upper, pfx, len);
+        upper[len] = (char) 0xFF;
+        upper[len + 1] = '\0';
+        NSUInteger first = [index lowerBound:pfx];
+        NSUInteger last = (len > 0) ? [index lowerBound:upper] : [index count];
+        free(upper);
+        
+        if (first != NSNotFound && last != NSNotFound) {
+            NSUInteger matches = last - first;
+            NSUInteger start = first + MIN(offset, matches);
+            ary = [NSMutableArray arrayWithCapacity:MIN(limit, last - start)];
+            for (NSUInteger i = start; i < last && [ary count] < limit; i++) {
+                const char *ID = [index idAtIndex:i];
+                if (ID == NULL) {
+                    ary = nil;
+                    break;
+                }
+                [ary addObject:[NSString stringWithCString:ID encoding:NSUTF8StringEncoding]];
+            }
+            if (ary != nil) {
+                if (total) *total = matches;
+                return ary;
+            }
+        }
+        // A corrupt page was hit: the index is rebuilt in the background
+    }
+    
+    // Slow path: load all the identifiers
+    NSArray *all = [self info:error];
+    if (all == nil) return nil;
+    NSMutableArray *matching = [NSMutableArray arrayWithCapacity:[all count]];
+    for (NSString *ID in all) {
+        if (prefix == nil || [ID hasPrefix:prefix]) [matching addObject:ID];
+    }
+    [matching sortUsingComparator:^NSComparisonResult(NSString *a, NSString *b) {
+        int cmp = strcmp([a UTF8String], [b UTF8String]);
+        return (cmp < 0) ? NSOrderedAscending : (cmp > 0 ? NSOrderedDescending : NSOrderedSame);
+    }];
+    NSUInteger start = MIN(offset, [matching count]);
+    NSRange range = NSMakeRange(start, MIN(limit, [matching count] - start));
+    ary = [NSMutableArray arrayWithArray:[matching subarrayWithRange:range]];
+    if (total) *total = [matching count];
+#endif
+    
+    return ary;
+}
+
 - (MSResult *)search:(MSImage *)qry error:(NSError **)error {
     MSResult *result = nil;
 
 #if MS_SDK_REQUIREMENTS
     ms_result_t *res = NULL;
+    [self lockShared];
+    uint64_t t = MSTraceNow();
     ms_errcode ecode = ms_scanner_search(_scanner, [qry image], &res);
+    MSTraceRecord(MS_TRACE_SEARCH, t);
+    [self unlock];
     if (ecode == MS_SUCCESS) {
         if (res != NULL) {
             result = [[[MSResult alloc] initWithResult:res] autorelease_stub];
@@ -259,12 +587,28 @@ static NSString *kMSDBFilename = @"ms.db";
     return result;
 }
 
+- (void)searchBatch:(NSArray *)queries withDelegate:(id<MSScannerDelegate>)delegate {
+#if MS_SDK_REQUIREMENTS
+    MSBatchSearch *op = [[[MSBatchSearch alloc] initWithScanner:self queries:queries] autorelease_stub];
+    [op setDelegate:delegate];
+    [_batchQueue addOperation:op];
+#endif
+}
+
+- (void)cancelBatchSearch {
+    [_batchQueue cancelAllOperations];
+}
+
 - (BOOL)match:(MSImage *)qry ref:(MSResult *)ref error:(NSError **)error {
     BOOL match = NO;
     
 #if MS_SDK_REQUIREMENTS
     int m;
+    [self lockShared];
+    uint64_t t = MSTraceNow();
     ms_errcode ecode = ms_scanner_match(_scanner, [qry image], [ref handle], &m);
+    MSTraceRecord(MS_TRACE_MATCH, t);
+    [self unlock];
     if (ecode == MS_SUCCESS) {
         match = (m == 1) ? YES : NO;
     }
@@ -284,19 +628,48 @@ static NSString *kMSDBFilename = @"ms.db";
 #endif
 }
 
+- (void)hybridSearch:(MSImage *)qry withDelegate:(id<MSScannerDelegate>)delegate {
+#if MS_SDK_REQUIREMENTS
+    MSApiSearch *op = [[[MSApiSearch alloc] initWithScanner:self query:qry] autorelease_stub];
+    [op setDelegate:delegate];
+    [op setHybrid:YES];
+    [_searchQueue addOperation:op];
+#endif
+}
+
+- (BOOL)flushOfflineQueueWithDelegate:(id<MSScannerDelegate>)delegate {
+#if MS_SDK_REQUIREMENTS
+    if ([_offlineQueue count] == 0 || [_flushQueue operationCount] > 0) return NO;
+    MSOfflineSearch *op = [[[MSOfflineSearch alloc] initWithScanner:self] autorelease_stub];
+    [op setDelegate:delegate];
+    [_flushQueue addOperation:op];
+    return YES;
+#else
+    return NO;
+#endif
+}
+
 - (void)cancelApiSearch {
     [_searchQueue cancelAllOperations];
 }
 
 - (MSResult *)decode:(MSImage *)qry formats:(int)formats error:(NSError **)error {
+    return [self decode:qry formats:formats like:nil error:error];
+}
+
+- (MSResult *)decode:(MSImage *)qry formats:(int)formats like:(MSResult *)ref error:(NSError **)error {
     MSResult *result = nil;
 
 #if MS_SDK_REQUIREMENTS
     ms_result_t *barcode = NULL;
+    [self lockShared];
+    uint64_t t = MSTraceNow();
     ms_errcode ecode = ms_scanner_decode(_scanner, [qry image], formats, &barcode);
+    MSTraceRecord(MS_TRACE_DECODE, t);
+    [self unlock];
     if (ecode == MS_SUCCESS) {
         if (barcode != NULL) {
-            result = [[[MSResult alloc] initWithResult:barcode] autorelease_stub];
+            result = [MSResult resultWithResult:barcode like:ref];
             ms_result_del(barcode);
         }
     }
@@ -308,6 +681,284 @@ static NSString *kMSDBFilename = @"ms.db";
     return result;
 }
 
+- (NSArray *)multiDecode:(MSImage *)qry formats:(int)formats error:(NSError **)error {
+    NSMutableArray *codes = [NSMutableArray array];
+
+#if MS_SDK_REQUIREMENTS
+    uint64_t t = MSTraceNow();
+
+    // Locate the candidate areas on a small gray copy (in the camera frame orientation)
+    MSGrayRect rects[MS_SCANNER_MULTI_DECODE_MAX];
+    int w = 0, h = 0, count = 0;
+    NSData *gray = [qry grayDataWithLongEdge:MS_IMG_MIN_SIZE width:&w height:&h];
+    if (gray != nil) {
+        MSImagePool *pool = [MSImagePool sharedPool];
+        int *scratch = (int *) [pool leaseBuffer:MS_CODE_REGIONS_SCRATCH(w, h) * sizeof(int)];
+        if (scratch != NULL) {
+            count = MSGrayCodeRegions((const uint8_t *) [gray bytes], w, h, w,
+                                      scratch, rects, MS_SCANNER_MULTI_DECODE_MAX);
+            [pool returnBuffer:scratch];
+        }
+    }
+
+    NSMutableArray *candidates = [NSMutableArray arrayWithCapacity:count + 1];
+    for (int i = 0; i < count; i++) {
+        CGRect region = CGRectMake((CGFloat) rects[i].x / w, (CGFloat) rects[i].y / h,
+                                   (CGFloat) rects[i].width / w, (CGFloat) rects[i].height / h);
+        MSImage *img = [qry imageWithRegion:region levels:0];
+        // Too small: grow it around its center (kept within the frame) until it fits
+        while (img == nil && (CGRectGetWidth(region) < 1 || CGRectGetHeight(region) < 1)) {
+            CGFloat rw = MIN(1, CGRectGetWidth(region) * MS_SCANNER_MULTI_DECODE_GROWTH);
+            CGFloat rh = MIN(1, CGRectGetHeight(region) * MS_SCANNER_MULTI_DECODE_GROWTH);
+            CGFloat rx = MIN(1 - rw, MAX(0, CGRectGetMidX(region) - rw / 2));
+            CGFloat ry = MIN(1 - rh, MAX(0, CGRectGetMidY(region) - rh / 2));
+            region = CGRectMake(rx, ry, rw, rh);
+            img = [qry imageWithRegion:region levels:0];
+        }
+        if (img != nil) [candidates addObject:img];
+    }
+    if ([candidates count] == 0) [candidates addObject:qry];
+
+    // Decode the areas in parallel: decodes only need a shared access
+    NSUInteger n = [candidates count];
+    NSMutableArray *results = [NSMutableArray arrayWithCapacity:n];
+    for (NSUInteger i = 0; i < n; i++) [results addObject:[NSNull null]];
+    __block NSError *failure = nil;
+
+    dispatch_apply(n, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+#if __has_feature(objc_arc)
+        @autoreleasepool {
+#else
+        NSAutoreleasePool *itemPool = [[NSAutoreleasePool alloc] init];
+#endif
+        NSError *err = nil;
+        MSResult *result = [self decode:[candidates objectAtIndex:i] formats:formats error:&err];
+        @synchronized(results) {
+            if (result != nil) [results replaceObjectAtIndex:i withObject:result];
+            if (err != nil && failure == nil) failure = [err retain_stub];
+        }
+#if __has_feature(objc_arc)
+        }
+#else
+        [itemPool release];
+#endif
+    });
+
+    // The same code may be found from several (overlapping) areas
+    for (id result in results) {
+        if (result == [NSNull null]) continue;
+        BOOL dup = NO;
+        for (MSResult *code in codes) {
+            if ([code isEqualToResult:result]) {
+                dup = YES;
+                break;
+            }
+        }
+        if (!dup) [codes addObject:result];
+    }
+
+    MSTraceRecord(MS_TRACE_MULTI, t);
+    OSAtomicIncrement64(&_multi.frames);
+    OSAtomicAdd64(count, &_multi.regions);
+    OSAtomicAdd64((int64_t) n, &_multi.decodes);
+    OSAtomicAdd64((int64_t) [codes count], &_multi.codes);
+
+    if (failure != nil) {
+        if (error) *error = [failure autorelease_stub];
+        else [failure release_stub];
+        return nil;
+    }
+#endif
+
+    return codes;
+}
+
+- (NSUInteger)generation {
+    return (NSUInteger) OSAtomicAdd32Barrier(0, &_generation);
+}
+
+- (MSIdIndex *)idIndex {
+    MSIdIndex *index = nil;
+    BOOL rebuild = NO;
+    @synchronized(self) {
+        if (_index != nil && [_index isCorrupt]) {
+            [_index release_stub];
+            _index = nil;
+            [[NSFileManager defaultManager] removeItemAtPath:_indexPath error:nil];
+            rebuild = YES;
+        }
+        index = [[_index retain_stub] autorelease_stub];
+    }
+#if MS_SDK_REQUIREMENTS
+    if (rebuild) [self loadIndexAsync];
+#endif
+    return index;
+}
+
+- (BOOL)isWriting {
+    return !!(_writers > 0);
+}
+
+- (MSScannerAccessStats)accessStats {
+    MSScannerAccessStats stats;
+    stats.shared = OSAtomicAdd64Barrier(0, &_access.shared);
+    stats.exclusive = OSAtomicAdd64Barrier(0, &_access.exclusive);
+    stats.contended = OSAtomicAdd64Barrier(0, &_access.contended);
+    stats.waitTime = OSAtomicAdd64Barrier(0, &_access.waitTime);
+    return stats;
+}
+
+- (MSScannerMultiDecodeStats)multiDecodeStats {
+    MSScannerMultiDecodeStats stats;
+    stats.frames = OSAtomicAdd64Barrier(0, &_multi.frames);
+    stats.regions = OSAtomicAdd64Barrier(0, &_multi.regions);
+    stats.decodes = OSAtomicAdd64Barrier(0, &_multi.decodes);
+    stats.codes = OSAtomicAdd64Barrier(0, &_multi.codes);
+    return stats;
+}
+
+- (void)lockShared {
+    [self lock:NO];
+}
+
+- (void)lockExclusive {
+    [self lock:YES];
+}
+
+- (void)unlock {
+    // Only the writer can see this flag set since it excludes any other access
+    if (_exclusive) {
+        _exclusive = NO;
+        OSAtomicDecrement32Barrier(&_writers);
+    }
+    pthread_rwlock_unlock(&_lock);
+}
+
+#pragma mark - Private
+
+- (void)lock:(BOOL)exclusive {
+    int (*trylock)(pthread_rwlock_t *) = exclusive ? pthread_rwlock_trywrlock : pthread_rwlock_tryrdlock;
+    int (*lock)(pthread_rwlock_t *) = exclusive ? pthread_rwlock_wrlock : pthread_rwlock_rdlock;
+
+    if (exclusive) OSAtomicIncrement32Barrier(&_writers);
+    if (trylock(&_lock) != 0) {
+        // Someone else holds the lock: wait for it and keep track of the contention
+        CFAbsoluteTime t = CFAbsoluteTimeGetCurrent();
+        lock(&_lock);
+        OSAtomicIncrement64(&_access.contended);
+        OSAtomicAdd64((int64_t) (1e6 * (CFAbsoluteTimeGetCurrent() - t)), &_access.waitTime);
+    }
+    if (exclusive) _exclusive = YES;
+    OSAtomicIncrement64(exclusive ? &_access.exclusive : &_access.shared);
+}
+
+#if MS_SDK_REQUIREMENTS
+- (ms_scanner_t *)openShadow:(ms_errcode *)ecode {
+    if (!_opened || _key == nil) {
+        *ecode = MS_MISUSE;
+        return NULL;
+    }
+    
+    NSFileManager *fm = [NSFileManager defaultManager];
+    
+    // Re-use the shadow database of an interrupted synchronization (the current
+    // attempt has already been recorded into the journal), otherwise start over
+    // from a copy of the current database
+    BOOL resume = ([_syncJournal attempts] > 1 && [fm fileExistsAtPath:_shadowPath]);
+    if (!resume) {
+        [fm removeItemAtPath:_shadowPath error:nil];
+        [self lockShared];
+        BOOL copied = [fm copyItemAtPath:_dbPath toPath:_shadowPath error:nil];
+        [self unlock];
+        if (!copied) {
+            *ecode = MS_NOFILE;
+            return NULL;
+        }
+    }
+    
+    ms_scanner_t *shadow = NULL;
+    *ecode = ms_scanner_new(&shadow);
+    if (*ecode != MS_SUCCESS) return NULL;
+    
+    *ecode = ms_scanner_open(shadow, [_shadowPath UTF8String], [_key UTF8String], [_secret UTF8String]);
+    if (*ecode != MS_SUCCESS) {
+        ms_scanner_del(shadow);
+        [fm removeItemAtPath:_shadowPath error:nil];
+        return NULL;
+    }
+    
+    MSDLog(@" [SYNC] SHADOW DATABASE %@", resume ? @"RESUMED" : @"CREATED");
+    return shadow;
+}
+
+// Map the identifiers index, or build it if it is missing or outdated
+// NOTE: this must run on the index queue
+- (void)loadIndex {
+    MSIdIndex *index = [[MSIdIndex alloc] initWithPath:_indexPath database:_dbPath];
+    if (index == nil) {
+        int cnt = 0;
+        char **ids = NULL;
+        [self lockShared];
+        ms_errcode ecode = ms_scanner_info(_scanner, &cnt, &ids);
+        if (ecode == MS_SUCCESS || ecode == MS_EMPTY) {
+            if ([MSIdIndex writeIds:ids count:(ids ? cnt : 0) forDatabase:_dbPath toPath:_indexPath])
+                index = [[MSIdIndex alloc] initWithPath:_indexPath database:_dbPath];
+        }
+        [self unlock];
+        if (ids != NULL) {
+            for (int i = 0; i < cnt; i++) free(ids[i]);
+            free(ids);
+        }
+        MSDLog(@" [SCANNER] ID INDEX %@ (%d IMAGE(S))", index ? @"BUILT" : @"UNAVAILABLE", cnt);
+    }
+    
+    @synchronized(self) {
+        [_index release_stub];
+        _index = index;
+    }
+}
+
+- (void)loadIndexAsync {
+    dispatch_async(_indexQueue, ^{
+        [self loadIndex];
+    });
+}
+
+- (ms_errcode)swapShadow {
+    // Searches only pause for the time needed to close, rename and reopen: the
+    // pending online requests, whose handles depend on the scanner, are aborted
+    // beforehand and retried once the new database is open
+    [_apiClient drain];
+    [self lockExclusive];
+    ms_scanner_close(_scanner);
+    unlink([_backupPath fileSystemRepresentation]);
+    link([_dbPath fileSystemRepresentation], [_backupPath fileSystemRepresentation]);
+    BOOL swapped = (rename([_shadowPath fileSystemRepresentation], [_dbPath fileSystemRepresentation]) == 0);
+    int errnum = swapped ? 0 : errno;
+    ms_errcode ecode = ms_scanner_open(_scanner, [_dbPath UTF8String], [_key UTF8String], [_secret UTF8String]);
+    BOOL opened = (ecode == MS_SUCCESS);
+    if (!opened && swapped) {
+        // Put the previous database back rather than leaving the scanner closed
+        MSDLog(@" [SYNC] CAN'T OPEN THE NEW DATABASE (%@): RESTORING THE BACKUP", MSErrMsg(ecode));
+        ms_scanner_close(_scanner);
+        if (rename([_backupPath fileSystemRepresentation], [_dbPath fileSystemRepresentation]) == 0)
+            opened = (ms_scanner_open(_scanner, [_dbPath UTF8String], [_key UTF8String], [_secret UTF8String]) == MS_SUCCESS);
+    }
+    else if (opened && swapped) {
+        OSAtomicIncrement32Barrier(&_generation);
+    }
+    _opened = opened;
+    [self unlock];
+    [_apiClient resume];
+    
+    if (!swapped) {
+        MSDLog(@" [SYNC] CAN'T SWAP THE SHADOW DATABASE: %s", strerror(errnum));
+        if (ecode == MS_SUCCESS) ecode = MS_ERROR;
+    }
+    return ecode;
+}
+#endif
+
 #pragma mark - NSNotifications
 
 #if MS_SDK_REQUIREMENTS
@@ -319,6 +970,20 @@ static NSString *kMSDBFilename = @"ms.db";
         MSDLog(@" [APP EXIT] SCANNER CLOSE ERROR: %@", errStr);
     }
 }
+
+- (void)applicationDidBecomeActive:(void *)ignored {
+    if (_opened) [self resumeSyncWithDelegate:nil];
+    if (_opened) [self flushOfflineQueueWithDelegate:nil];
+}
+
+#pragma mark - Reachability
+
+- (void)reachabilityChanged:(SCNetworkReachabilityFlags)flags {
+    BOOL reachable = (flags & kSCNetworkReachabilityFlagsReachable) &&
+                     !(flags & kSCNetworkReachabilityFlagsConnectionRequired);
+    MSDLog(@" [SCANNER] API %@", reachable ? @"REACHABLE" : @"UNREACHABLE");
+    if (reachable && _opened) [self flushOfflineQueueWithDelegate:nil];
+}
 #endif
 
 @end
@@ -29,10 +29,33 @@
 #import "MSImage.h"
 #import "MSResult.h"
 #import "MSCaptureSession.h"
+#import "MSScanEngine.h"
+#import "MSScanScheduler.h"
 #import "MSObjC.h"
 
 @protocol MSScannerSessionDelegate;
 
+/**
+ * Counters of the scanner session frame pipeline
+ *
+ * Frames are turned into query images on the capture queue, then scanned on
+ * a dedicated queue. At most `MS_SCAN_SESSION_MAX_PENDING` frames can be in
+ * flight: any subsequent frame is dropped until a slot is available.
+ */
+typedef struct {
+    NSUInteger captured;    /* number of frames delivered by the camera */
+    NSUInteger dropped;     /* number of frames dropped because the pipeline was full */
+    NSUInteger scanned;     /* number of frames handled by the scanning queue */
+    NSUInteger pending;     /* number of frames currently in flight */
+    NSUInteger maxPending;  /* highest number of frames in flight at once */
+    double imageTime;       /* cumulated query image creation time in seconds */
+    double waitTime;        /* cumulated time spent by frames waiting to be scanned in seconds */
+    double scanTime;        /* cumulated scan time in seconds */
+} MSScanSessionStats;
+
+/** Maximum number of frames in flight (being scanned or waiting to be) */
+#define MS_SCAN_SESSION_MAX_PENDING 2
+
 /** Current scanner session state */
 typedef enum {
     MS_SCAN_STATE_DEFAULT = 0,
@@ -44,12 +67,17 @@ typedef enum {
 <MSScannerDelegate, MSCaptureSessionDelegate>
 {
     NSInteger _scanOptions;
-    MSResult *_result;
-    int _losts;
+    MSScanEngine *_engine;
+    MSScanScheduler *_scheduler;
     MSScanner *_scanner;
     BOOL _snap;
+    BOOL _hybrid;
     MSScanState _state;
+    BOOL _capturing;
     MSCaptureSession *_captureSession;
+    dispatch_queue_t _scanQueue;
+    dispatch_semaphore_t _slots;
+    MSScanSessionStats _stats;
 #if __has_feature(objc_arc_weak)
     id<MSScannerSessionDelegate> __weak _delegate;
 #elif __has_feature(objc_arc)
@@ -68,6 +96,24 @@ typedef enum {
 @property (nonatomic, assign) id<MSScannerSessionDelegate> delegate;
 #endif
 @property (nonatomic, readonly) MSScanState state;
+/** Engine used to scan the incoming frames */
+@property (nonatomic, readonly) MSScanEngine *engine;
+/**
+ * Scheduler deciding which incoming frames are worth scanning
+ *
+ * Its settings can be tuned to trade CPU (and battery) for reactivity. Set
+ * its `motionThreshold` to 0 and its `searchBudget` to 1 to scan every frame.
+ */
+@property (nonatomic, readonly) MSScanScheduler *scheduler;
+/**
+ * Race an offline search against the online one on `snap` (default: YES)
+ *
+ * The offline result is returned as soon as it matches, without waiting for
+ * the network. Set to NO to always rely on the online search only.
+ */
+@property (nonatomic, assign) BOOL hybrid;
+/** Frame pipeline counters */
+@property (readonly) MSScanSessionStats stats;
 /** Layer used to display the video capture */
 @property (nonatomic, readonly) CALayer *previewLayer;
 
@@ -90,7 +136,9 @@ typedef enum {
 /**
  * Stop the video capture.
  *
- * Since no more frames are consumed, scanning is completely turned off.
+ * Since no more frames are consumed, scanning is completely turned off. This
+ * waits for the frame being scanned, if any: the frames still queued are then
+ * dropped without messaging the delegate.
  *
  * Also, if you plan to re-start a capture by calling `startCapture` again
  * take care to update the preview layer (`previewLayer`) on your view, since
@@ -165,4 +213,14 @@ typedef enum {
 - (void)session:(MSScannerSession *)scanner didScan:(MSResult *)result;
 @optional
 - (void)session:(MSScannerSession *)scanner failedToScan:(NSError *)error;
+/**
+ * Dispatched right after `session:didScan:` while the engine tracker follows the
+ * locked result, with its current position (e.g. to draw it over the preview)
+ */
+- (void)session:(MSScannerSession *)scanner didTrackResult:(MSResult *)result inQuad:(MSQuad)quad;
+/**
+ * Dispatched right after `session:didScan:` with every barcode decoded from the
+ * frame when the engine decodes several codes at once (see `multiDecode`)
+ */
+- (void)session:(MSScannerSession *)scanner didScanCodes:(NSArray *)codes;
 @end
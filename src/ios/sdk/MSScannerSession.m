@@ -22,10 +22,10 @@
  */
 
 #import "MSScannerSession.h"
+#import "MSTrace.h"
 
 @interface MSScannerSession ()
 
-- (MSResult *)scan:(MSImage *)qry options:(int)options error:(NSError **)error;
 - (void)reset;
 
 @end
@@ -35,28 +35,46 @@
 @synthesize scanOptions = _scanOptions;
 @synthesize delegate = _delegate;
 @synthesize state = _state;
+@synthesize engine = _engine;
+@synthesize scheduler = _scheduler;
+@synthesize hybrid = _hybrid;
 
 - (id)initWithScanner:(MSScanner *)scanner {
     self = [super init];
     if (self) {
         _scanOptions = MS_RESULT_TYPE_IMAGE;
-        _result = nil;
-        _losts = 0;
         _snap = NO;
+        _hybrid = YES;
         _state = MS_SCAN_STATE_DEFAULT;
+        _capturing = NO;
         _scanner = scanner;
+        _engine = [[MSScanEngine alloc] initWithScanner:scanner];
+        _scheduler = [[MSScanScheduler alloc] init];
         _captureSession = [[MSCaptureSession alloc] init];
+        _scanQueue = dispatch_queue_create("moodstocks-scan-session", DISPATCH_QUEUE_SERIAL);
+        _slots = dispatch_semaphore_create(MS_SCAN_SESSION_MAX_PENDING);
+        memset(&_stats, 0, sizeof(_stats));
         _delegate = nil;
     }
     return self;
 }
 
 - (void)dealloc {
-    [_result release_stub];
-    _result = nil;
+    [_engine release_stub];
+    _engine = nil;
+    
+    [_scheduler release_stub];
+    _scheduler = nil;
     
     [_captureSession release_stub];
 
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+    dispatch_release(_scanQueue);
+    dispatch_release(_slots);
+#endif
+    _scanQueue = NULL;
+    _slots = NULL;
+
     _delegate = nil;
 
 #if ! __has_feature(objc_arc)
@@ -65,12 +83,30 @@
 }
 
 - (void)reset {
-    [_result release_stub];
-    _result = nil;
-    _losts = 0;
+    // The engine and the scheduler are only ever used from the scanning queue
+    dispatch_async(_scanQueue, ^{
+        [_engine reset];
+        [_scheduler reset];
+    });
     _snap = NO;
 }
 
+- (void)setDelegate:(id<MSScannerSessionDelegate>)delegate {
+    // The delegate is messaged from the scanning queue, so it must not go away
+    // in the middle of a scan
+    dispatch_sync(_scanQueue, ^{
+        _delegate = delegate;
+    });
+}
+
+- (MSScanSessionStats)stats {
+    MSScanSessionStats stats;
+    @synchronized(self) {
+        stats = _stats;
+    }
+    return stats;
+}
+
 - (CALayer *)previewLayer {
     CALayer *layer = nil;
 #if MS_IPHONE_OS_REQUIREMENTS
@@ -80,6 +116,9 @@
 }
 
 - (void)startCapture {
+    dispatch_sync(_scanQueue, ^{
+        _capturing = YES;
+    });
     [_captureSession setDelegate:self];
     [_captureSession start];
 }
@@ -87,6 +126,11 @@
 - (void)stopCapture {
     [_captureSession stop];
     [_captureSession setDelegate:nil];
+    
+    // Wait for the frame being scanned: the ones queued behind are skipped
+    dispatch_sync(_scanQueue, ^{
+        _capturing = NO;
+    });
 }
 
 - (void)playCapture {
@@ -110,83 +154,6 @@
     return YES;
 }
 
-- (MSResult *)scan:(MSImage *)qry options:(int)options error:(NSError **)error {
-    MSResult *result = nil;
-#if MS_SDK_REQUIREMENTS
-    BOOL lock = NO;
-    if (_result != nil && _losts < 2) {
-        int _resultType = [_result getType];
-        NSInteger found = 0;
-        if (_resultType == MS_RESULT_TYPE_IMAGE) {
-            found = [_scanner match:qry ref:_result error:nil] ? 1 : -1;
-        }
-        else if (_resultType == MS_RESULT_TYPE_QRCODE) {
-            MSResult *qr = [_scanner decode:qry formats:MS_RESULT_TYPE_QRCODE error:nil];
-            found = [qr isEqualToResult:_result] ? 1 : -1;
-        }
-        else if (_resultType == MS_RESULT_TYPE_DMTX) {
-            MSResult *dmtx = [_scanner decode:qry formats:MS_RESULT_TYPE_DMTX error:nil];
-            found = [dmtx isEqualToResult:_result] ? 1 : -1;
-        }
-
-        if (found == 1) {
-            // The current frame matches with the previous result
-            lock = YES;
-            _losts = 0;
-        }
-        else if (found == -1) {
-            // The current frame looks different so release the lock
-            // if there is enough consecutive "no match"
-            _losts++;
-            lock = (_losts >= 2) ? NO : YES;
-        }
-    }
-
-    if (lock) {
-        // Re-use the previous result and skip searching / decoding
-        // the current frame
-        result = [[_result copy] autorelease_stub];
-    }
-
-    // -------------------------------------------------
-    // Image search
-    // -------------------------------------------------
-    if (result == nil && (options & MS_RESULT_TYPE_IMAGE)) {
-        NSError *err  = nil;
-        result = [_scanner search:qry error:&err];
-        if (err != nil && [err code] != MS_EMPTY) {
-            if (error) *error = err;
-            return nil;
-        }
-        if (result != nil) {
-            _losts = 0;
-        }
-    }
-
-    // -------------------------------------------------
-    // Barcode decoding
-    // -------------------------------------------------
-    if (result == nil) {
-        NSError *err  = nil;
-        result = [_scanner decode:qry formats:options error:&err];
-        if (err != nil) {
-            if (error) *error = err;
-            return nil;
-        }
-        if (result != nil) {
-            _losts = 0;
-        }
-    }
-
-    if (![result isEqualToResult:_result]) {
-        [_result release_stub];
-        _result = [result copy];
-    }
-
-#endif
-    return result;
-}
-
 - (BOOL)snap {
     if (_state != MS_SCAN_STATE_DEFAULT) return NO;
     _snap = YES;
@@ -205,24 +172,82 @@
 - (void)session:(MSCaptureSession *)session didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer {
     if (_state != MS_SCAN_STATE_DEFAULT) return;
     
-    MSImage *qry = [[MSImage alloc] initWithBuffer:sampleBuffer orientation:session.orientation];
-    
     if (_snap) {
         _snap = NO;
         _state = MS_SCAN_STATE_SEARCH;
-        [_scanner apiSearch:qry withDelegate:self];
+        MSImage *qry = [[MSImage alloc] initWithBuffer:sampleBuffer orientation:session.orientation];
+        if (_hybrid)
+            [_scanner hybridSearch:qry withDelegate:self];
+        else
+            [_scanner apiSearch:qry withDelegate:self];
         [qry release_stub];
         return;
     }
     
-    NSError *error = nil;
-    MSResult *result = [self scan:qry options:_scanOptions error:&error];
-    if (!error)
-        [_delegate session:self didScan:result];
-    else if ([_delegate respondsToSelector:@selector(session:failedToScan:)])
-        [_delegate performSelector:@selector(session:failedToScan:) withObject:error];
+    // Back-pressure: drop the frame if the scanning queue is already full
+    BOOL full = (dispatch_semaphore_wait(_slots, DISPATCH_TIME_NOW) != 0);
+    @synchronized(self) {
+        _stats.captured++;
+        if (full) {
+            _stats.dropped++;
+        }
+        else {
+            _stats.pending++;
+            if (_stats.pending > _stats.maxPending) _stats.maxPending = _stats.pending;
+        }
+    }
+    if (full) return;
     
-    [qry release_stub];
+    uint64_t arrival = MSTraceNow();
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    // NOTE: the frame is kept until scanned, which is bounded by the number of slots
+    MSImage *qry = [[MSImage alloc] initWithBuffer:sampleBuffer orientation:session.orientation keepFrame:YES];
+    CFAbsoluteTime created = CFAbsoluteTimeGetCurrent();
+    MSTraceRecord(MS_TRACE_IMAGE, arrival);
+    
+    dispatch_async(_scanQueue, ^{
+        CFAbsoluteTime t = CFAbsoluteTimeGetCurrent();
+        
+        int options = _scanOptions;
+        MSScheduleDecision decision = MS_SCHED_SKIP;
+        if (_capturing && _state == MS_SCAN_STATE_DEFAULT)
+            decision = [_scheduler decisionForFrame:qry options:options locked:([_engine result] != nil)];
+        
+        if (decision != MS_SCHED_SKIP) {
+            if (decision == MS_SCHED_DECODE) options &= ~MS_RESULT_TYPE_IMAGE;
+            
+            NSTimeInterval searchTime = [_engine stats].searchTime;
+            NSError *error = nil;
+            MSResult *result = [_engine scan:qry options:options error:&error];
+            searchTime = [_engine stats].searchTime - searchTime;
+            [_scheduler didScanFrame:qry searchTime:searchTime found:(result != nil)];
+            
+            if (!error)
+                [_delegate session:self didScan:result];
+            else if ([_delegate respondsToSelector:@selector(session:failedToScan:)])
+                [_delegate performSelector:@selector(session:failedToScan:) withObject:error];
+            
+            NSArray *codes = [_engine codes];
+            if (!error && [codes count] > 0 && [_delegate respondsToSelector:@selector(session:didScanCodes:)])
+                [_delegate session:self didScanCodes:codes];
+            
+            MSPatchTracker *tracker = [_engine tracker];
+            if (result != nil && [tracker isTracking] &&
+                [_delegate respondsToSelector:@selector(session:didTrackResult:inQuad:)])
+                [_delegate session:self didTrackResult:result inQuad:[tracker quad]];
+        }
+        
+        @synchronized(self) {
+            _stats.scanned++;
+            _stats.pending--;
+            _stats.imageTime += created - start;
+            _stats.waitTime += t - created;
+            _stats.scanTime += CFAbsoluteTimeGetCurrent() - t;
+        }
+        MSTraceRecord(MS_TRACE_FRAME, arrival);
+        [qry release_stub];
+        dispatch_semaphore_signal(_slots);
+    });
 }
 #endif
 
@@ -244,6 +269,18 @@
     }
 }
 
+- (void)scanner:(MSScanner *)scanner didQueueSearch:(MSQueuedQuery *)query {
+    _state = MS_SCAN_STATE_DEFAULT;
+
+    if ([_delegate respondsToSelector:@selector(scanner:didQueueSearch:)]) {
+        [_delegate scanner:_scanner didQueueSearch:query];
+    }
+    else if ([_delegate respondsToSelector:@selector(scanner:failedToSearchWithError:)]) {
+        NSError *error = [NSError errorWithDomain:@"moodstocks-sdk" code:MS_NOCONN userInfo:nil];
+        [_delegate scanner:_scanner failedToSearchWithError:error];
+    }
+}
+
 - (void)scanner:(MSScanner *)scanner failedToSearchWithError:(NSError *)error {
     _state = MS_SCAN_STATE_DEFAULT;
 
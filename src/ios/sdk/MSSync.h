@@ -24,8 +24,33 @@
 #import "MSAvailability.h"
 #import "MSScanner.h"
 
+/** Default delay in seconds between two progress notifications (i.e. one per display frame) */
+#define MS_SYNC_PROGRESS_INTERVAL (1.0 / 60)
+
+/**
+ * Progress notification counters accumulated over all the synchronizations
+ */
+typedef struct {
+    int64_t produced;       /* number of progress reports received from the SDK */
+    int64_t delivered;      /* number of progress notifications dispatched to the delegates */
+} MSSyncProgressStats;
+
+/**
+ * Background synchronization
+ *
+ * The SDK reports the progress once per signature fetched: the synchronization
+ * thread only publishes it, and the delegates are notified of the latest value
+ * on the main thread at most once every `progressInterval`. The last progress
+ * is always notified before the synchronization completes (or fails).
+ */
 @interface MSSync : NSOperation {
     MSScanner *_scanner;
+    volatile int64_t _progress;
+    volatile int64_t _produced;
+    int64_t _delivered;
+    int64_t _lastProgress;
+    NSTimeInterval _progressInterval;
+    dispatch_source_t _progressTimer;
 #if __has_feature(objc_arc_weak)
     id<MSScannerDelegate> __weak _delegate;
 #elif __has_feature(objc_arc)
@@ -40,6 +65,18 @@
 
 - (id)initWithScanner:(MSScanner *)scanner;
 
+/**
+ * Smallest delay in seconds between two progress notifications
+ *
+ * Default: `MS_SYNC_PROGRESS_INTERVAL`.
+ */
+@property (nonatomic, assign) NSTimeInterval progressInterval;
+
+/**
+ * Progress notification counters over all the synchronizations so far
+ */
++ (MSSyncProgressStats)progressStats;
+
 #if __has_feature(objc_arc_weak)
 @property (nonatomic, weak) id<MSScannerDelegate> delegate;
 #elif __has_feature(objc_arc)
@@ -24,13 +24,60 @@
 #include "moodstocks_sdk.h"
 
 #import "MSSync.h"
+#import "MSSyncJournal.h"
+#import "MSDebug.h"
 #import "MSObjC.h"
 
+#include <libkern/OSAtomic.h>
+
+/** Maximum number of retries after a transient failure (e.g. connection lost) */
+#define MS_SYNC_MAX_RETRIES 3
+/** Delay in seconds before the first retry (doubled at each retry) */
+#define MS_SYNC_RETRY_DELAY 2.0
+
+/**
+ * Pack a (current, total) progress into a single word so that it is published
+ * atomically (the shift is done unsigned since `total` is -1 until known)
+ */
+#define MS_SYNC_PROGRESS(current, total) ((int64_t) (((uint64_t) (uint32_t) (total) << 32) | (uint32_t) (current)))
+
+static MSSyncProgressStats gMSSyncProgressStats = { 0, 0 };
+
+static BOOL mssync_is_transient(ms_errcode ecode) {
+    switch (ecode) {
+        case MS_BUSY:
+        case MS_NOCONN:
+        case MS_TIMEOUT:
+        case MS_SLOWCONN:
+        case MS_UNAVAIL:
+            return YES;
+        default:
+            return NO;
+    }
+}
+
+// Identifiers of an index the changelog could not be merged from (corrupt
+// pages are skipped)
+static NSArray *mssync_index_ids(MSIdIndex *index) {
+    NSMutableArray *ids = [NSMutableArray arrayWithCapacity:[index count]];
+    for (NSUInteger i = 0; i < [index count]; i++) {
+        const char *ID = [index idAtIndex:i];
+        if (ID != NULL) [ids addObject:[NSString stringWithUTF8String:ID]];
+    }
+    return ids;
+}
+
 @interface MSSync ()
 @property (nonatomic, assign) NSInteger current;
 @property (nonatomic, assign) NSInteger total;
+@property (nonatomic, readonly) MSSyncJournal *journal;
+- (void)publishProgress:(int)current total:(int)total;
+- (void)startProgress;
+- (void)deliverProgress;
+- (void)stopProgress;
 - (void)willSync;
 - (void)didSyncWithProgress;
+- (void)didSyncWithChangelog:(MSSyncChangelog *)changelog;
 - (void)didSync;
 - (void)failedToSyncWithError:(NSError *)error;
 @end
@@ -41,18 +88,18 @@ static void mssync_progress_cb(void *opq, int total, int current) {
 #else
     MSSync *syncOp = (MSSync *) opq;
 #endif
-    syncOp.total = total;
-    syncOp.current = current;
-    [syncOp performSelectorOnMainThread:@selector(didSyncWithProgress)
-                             withObject:nil
-                          waitUntilDone:NO /* do not change */];
+    [syncOp.journal progress:current total:total];
+    // NOTE: the delegates are notified by the progress timer (see `startProgress`)
+    [syncOp publishProgress:current total:total];
 }
 
 @implementation MSSync
 
 @synthesize delegate = _delegate;
+@synthesize progressInterval = _progressInterval;
 @synthesize current;
 @synthesize total;
+@dynamic journal;
 
 - (id)initWithScanner:(MSScanner *)scanner {
     self = [super init];
@@ -61,7 +108,12 @@ static void mssync_progress_cb(void *opq, int total, int current) {
         _delegate = nil;
         self.current = 0;
         self.total = -1;
-        
+        _progress = MS_SYNC_PROGRESS(0, -1);
+        _lastProgress = _progress;
+        _produced = 0;
+        _delivered = 0;
+        _progressInterval = MS_SYNC_PROGRESS_INTERVAL;
+        _progressTimer = NULL;
     }
     return self;
 }
@@ -75,7 +127,15 @@ static void mssync_progress_cb(void *opq, int total, int current) {
 #endif
 }
 
++ (MSSyncProgressStats)progressStats {
+    @synchronized([MSSync class]) {
+        return gMSSyncProgressStats;
+    }
+}
+
 - (void)cancel {
+    [self.journal fail:-1 /* cancel error */];
+
     NSError *error = [NSError errorWithDomain:@"moodstocks-sdk" code:-1 /* cancel error */ userInfo:nil];
     [self performSelectorOnMainThread:@selector(failedToSyncWithError:) withObject:error waitUntilDone:YES];
 
@@ -101,9 +161,12 @@ static void mssync_progress_cb(void *opq, int total, int current) {
     }];
     
     NSError *error = nil;
+    NSArray *before = nil;
+    MSIdIndex *beforeIndex = nil;
     
     if (![self isCancelled]) {
         [self performSelectorOnMainThread:@selector(willSync) withObject:nil waitUntilDone:YES];
+        [self performSelectorOnMainThread:@selector(startProgress) withObject:nil waitUntilDone:YES];
         
 #if __has_feature(objc_arc)
         void *opq = (__bridge void *) self;
@@ -111,11 +174,53 @@ static void mssync_progress_cb(void *opq, int total, int current) {
         void *opq = (void *) self;
 #endif
         
-        ms_errcode ecode = ms_scanner_sync2([_scanner handle], mssync_progress_cb, opq);
-        if (ecode != MS_SUCCESS) {
-            error = [NSError errorWithDomain:@"moodstocks-sdk" code:ecode userInfo:nil];
+        // Keep the index of the database content to tell what the synchronization
+        // changed (it stays mapped once replaced), or snapshot it if unavailable
+        beforeIndex = [[_scanner idIndex] retain_stub];
+        if (beforeIndex == nil) before = [_scanner info:nil];
+        
+        // The journal is kept until the synchronization completes so that an
+        // interrupted one is resumed later on
+        for (int retries = 0; ![self isCancelled]; retries++) {
+            [self.journal begin];
+            
+            // Searches keep running on the current database in the meantime
+            error = nil;
+            if ([_scanner syncWithProgress:mssync_progress_cb opaque:opq error:&error]) {
+                [self.journal finish];
+                break;
+            }
+            
+            // Only an interrupted synchronization is worth resuming later on
+            ms_errcode ecode = [error code];
+            if (mssync_is_transient(ecode) || ecode == MS_ABORT || [self isCancelled])
+                [self.journal fail:ecode];
+            else
+                [self.journal abandon:ecode];
+            if (!mssync_is_transient(ecode) || retries >= MS_SYNC_MAX_RETRIES)
+                break;
+            
+            [NSThread sleepForTimeInterval:MS_SYNC_RETRY_DELAY * (1 << retries)];
+        }
+    }
+    
+    // Flush the last progress before notifying the end of the synchronization
+    [self performSelectorOnMainThread:@selector(stopProgress) withObject:nil waitUntilDone:YES];
+    
+    if (![self isCancelled] && !error) {
+        MSSyncChangelog *changelog = nil;
+        MSIdIndex *afterIndex = [_scanner idIndex];
+        if (beforeIndex != nil && afterIndex != nil)
+            changelog = [[MSSyncChangelog alloc] initWithIndex:beforeIndex index:afterIndex];
+        if (changelog == nil) {
+            if (before == nil) before = mssync_index_ids(beforeIndex);
+            changelog = [[MSSyncChangelog alloc] initWithIds:before ids:[_scanner info:nil]];
         }
+        MSDLog(@" [SYNC] CHANGELOG: %@", changelog);
+        [self performSelectorOnMainThread:@selector(didSyncWithChangelog:) withObject:changelog waitUntilDone:YES];
+        [changelog release_stub];
     }
+    [beforeIndex release_stub];
     
     if (![self isCancelled]) {
         if (!error) {
@@ -143,6 +248,65 @@ static void mssync_progress_cb(void *opq, int total, int current) {
 
 #pragma mark - Private
 
+- (MSSyncJournal *)journal {
+    return [_scanner syncJournal];
+}
+
+- (void)publishProgress:(int)current total:(int)total {
+    int64_t progress = MS_SYNC_PROGRESS(current, total);
+    int64_t old;
+    do {
+        old = _progress;
+    } while (!OSAtomicCompareAndSwap64Barrier(old, progress, &_progress));
+    OSAtomicIncrement64(&_produced);
+}
+
+// NOTE: the progress timer methods below run on the main thread
+
+- (void)startProgress {
+    if (_progressTimer != NULL) return;
+    
+    uint64_t interval = (uint64_t) (((_progressInterval > 0) ? _progressInterval : MS_SYNC_PROGRESS_INTERVAL) * NSEC_PER_SEC);
+    _progressTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+    dispatch_source_set_timer(_progressTimer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, interval / 10);
+    // NOTE: the timer retains the operation until `stopProgress` is called
+    dispatch_source_set_event_handler(_progressTimer, ^{
+        [self deliverProgress];
+    });
+    dispatch_resume(_progressTimer);
+}
+
+- (void)deliverProgress {
+    int64_t progress = OSAtomicAdd64Barrier(0, &_progress);
+    if (progress == _lastProgress) return;
+    
+    // Intermediate values published since the last notification are skipped
+    _lastProgress = progress;
+    self.current = (int32_t) (uint32_t) progress;
+    self.total = (int32_t) (uint32_t) ((uint64_t) progress >> 32);
+    _delivered++;
+    [self didSyncWithProgress];
+}
+
+- (void)stopProgress {
+    if (_progressTimer != NULL) {
+        dispatch_source_cancel(_progressTimer);
+#if !OS_OBJECT_USE_OBJC_RETAIN_RELEASE
+        dispatch_release(_progressTimer);
+#endif
+        _progressTimer = NULL;
+    }
+    // NOTE: a cancelled synchronization has already been notified as failed
+    if (![self isCancelled]) [self deliverProgress];
+    
+    int64_t produced = OSAtomicAdd64Barrier(0, &_produced);
+    MSDLog(@" [SYNC] PROGRESS: %lld REPORT(S) PRODUCED, %lld DELIVERED", produced, _delivered);
+    @synchronized([MSSync class]) {
+        gMSSyncProgressStats.produced += produced;
+        gMSSyncProgressStats.delivered += _delivered;
+    }
+}
+
 // NOTE: these methods take care to notify the extra-delegates (if any) held by the scanner
 
 - (void)willSync {
@@ -169,6 +333,20 @@ static void mssync_progress_cb(void *opq, int total, int current) {
     }
 }
 
+- (void)didSyncWithChangelog:(MSSyncChangelog *)changelog {
+    if ([_delegate respondsToSelector:@selector(scanner:didSyncWithChangelog:)])
+        [_delegate performSelector:@selector(scanner:didSyncWithChangelog:)
+                        withObject:_scanner
+                        withObject:changelog];
+    
+    for (id<MSScannerDelegate> extra in [_scanner syncDelegates]) {
+        if ([extra respondsToSelector:@selector(scanner:didSyncWithChangelog:)] && extra != _delegate)
+            [extra performSelector:@selector(scanner:didSyncWithChangelog:)
+                        withObject:_scanner
+                        withObject:changelog];
+    }
+}
+
 - (void)didSync {
     if ([_delegate respondsToSelector:@selector(scannerDidSync:)])
         [_delegate performSelector:@selector(scannerDidSync:) withObject:_scanner];
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "MSIdIndex.h"
+
+/**
+ * Changes brought by a synchronization to the local database
+ *
+ * It is obtained by diffing the identifiers indexes of the database (see
+ * `-[MSScanner idIndex]`) before and after the synchronization, or the image
+ * identifiers it records (see `-[MSScanner info:]`) if no index is available.
+ */
+@interface MSSyncChangelog : NSObject {
+    NSArray *_added;
+    NSArray *_removed;
+    NSUInteger _unchanged;
+}
+
+/** Identifiers of the images added by the synchronization */
+@property (nonatomic, readonly) NSArray *added;
+/** Identifiers of the images removed by the synchronization */
+@property (nonatomic, readonly) NSArray *removed;
+/** Number of images left as is */
+@property (nonatomic, readonly) NSUInteger unchanged;
+
+/**
+ * Diff two arrays of image identifiers
+ */
+- (id)initWithIds:(NSArray *)before ids:(NSArray *)after;
+
+/**
+ * Diff two identifiers indexes
+ *
+ * Both sorted lists are merged in a single pass so that only the added and
+ * removed identifiers get loaded. Returns nil if a corrupt page is met.
+ */
+- (id)initWithIndex:(MSIdIndex *)before index:(MSIdIndex *)after;
+
+/**
+ * Property list representation of the changelog (`added`, `removed` and
+ * `unchanged` keys)
+ */
+- (NSDictionary *)dictionary;
+
+@end
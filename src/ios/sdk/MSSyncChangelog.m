@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#import "MSSyncChangelog.h"
+#import "MSObjC.h"
+
+@implementation MSSyncChangelog
+
+@synthesize added = _added;
+@synthesize removed = _removed;
+@synthesize unchanged = _unchanged;
+
+- (id)initWithIds:(NSArray *)before ids:(NSArray *)after {
+    self = [super init];
+    if (self) {
+        NSSet *previous = [NSSet setWithArray:(before ? before : [NSArray array])];
+        NSSet *current = [NSSet setWithArray:(after ? after : [NSArray array])];
+
+        NSMutableArray *added = [NSMutableArray array];
+        for (NSString *ID in after) {
+            if (![previous containsObject:ID]) [added addObject:ID];
+        }
+
+        NSMutableArray *removed = [NSMutableArray array];
+        for (NSString *ID in before) {
+            if (![current containsObject:ID]) [removed addObject:ID];
+        }
+
+        _added = [added copy];
+        _removed = [removed copy];
+        _unchanged = [current count] - [added count];
+    }
+    return self;
+}
+
+- (id)initWithIndex:(MSIdIndex *)before index:(MSIdIndex *)after {
+    self = [super init];
+    if (self) {
+        NSMutableArray *added = [NSMutableArray array];
+        NSMutableArray *removed = [NSMutableArray array];
+        NSUInteger unchanged = 0;
+        
+        NSUInteger i = 0, j = 0;
+        NSUInteger m = [before count], n = [after count];
+        while (i < m || j < n) {
+            const char *a = (i < m) ? [before idAtIndex:i] : NULL;
+            const char *b = (j < n) ? [after idAtIndex:j] : NULL;
+            if ((i < m && a == NULL) || (j < n && b == NULL)) {
+                [self release_stub];
+                return nil;
+            }
+            
+            int cmp = (a == NULL) ? 1 : ((b == NULL) ? -1 : strcmp(a, b));
+            if (cmp < 0) {
+                [removed addObject:[NSString stringWithUTF8String:a]];
+                i++;
+            }
+            else if (cmp > 0) {
+                [added addObject:[NSString stringWithUTF8String:b]];
+                j++;
+            }
+            else {
+                unchanged++;
+                i++;
+                j++;
+            }
+        }
+        
+        _added = [added copy];
+        _removed = [removed copy];
+        _unchanged = unchanged;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_added release_stub];
+    _added = nil;
+    [_removed release_stub];
+    _removed = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (NSDictionary *)dictionary {
+    return [NSDictionary dictionaryWithObjectsAndKeys:
+            _added, @"added",
+            _removed, @"removed",
+            [NSNumber numberWithUnsignedInteger:_unchanged], @"unchanged",
+            nil];
+}
+
+- (NSString *)description {
+    return [NSString stringWithFormat:@"<%@: +%d -%d =%d>", NSStringFromClass([self class]),
+            (int) [_added count], (int) [_removed count], (int) _unchanged];
+}
+
+@end
@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Persistent checkpoint of the database synchronization
+ *
+ * The journal is a small property list stored next to the database file. It
+ * records whether a synchronization is running, how far it went (as reported
+ * by the `ms_scanner_sync_cb` progress callback) and how many attempts were
+ * made so far.
+ *
+ * A journal left in the running or interrupted state (e.g. the background task
+ * expired, the app was killed or the network went down) tells that the last
+ * synchronization did not complete so that it can be resumed later. Permanent
+ * failures do not leave any journal behind (see `abandon:`). The SDK
+ * synchronization is incremental: the signatures already stored into the
+ * database are not downloaded again.
+ *
+ * This class is thread safe.
+ */
+@interface MSSyncJournal : NSObject {
+    NSString *_path;
+    BOOL _pending;
+    NSInteger _total;
+    NSInteger _current;
+    NSInteger _attempts;
+    NSInteger _lastError;
+    CFAbsoluteTime _savedAt;
+}
+
+/** Path of the journal file */
+@property (nonatomic, readonly) NSString *path;
+/** Flag indicating whether the last synchronization did not complete */
+@property (readonly, getter = isPending) BOOL pending;
+/** Total number of signatures of the last synchronization (-1 if unknown) */
+@property (readonly) NSInteger total;
+/** Number of signatures synchronized so far */
+@property (readonly) NSInteger current;
+/** Number of attempts made to complete the last synchronization */
+@property (readonly) NSInteger attempts;
+/** Error code of the last failed attempt (0 if none) */
+@property (readonly) NSInteger lastError;
+
+/**
+ * Open the journal stored at the given path (if any)
+ */
+- (id)initWithPath:(NSString *)path;
+
+/**
+ * Record the start of a synchronization attempt
+ */
+- (void)begin;
+
+/**
+ * Record the synchronization progress
+ *
+ * The journal file is only written from time to time to keep this cheap.
+ */
+- (void)progress:(NSInteger)current total:(NSInteger)total;
+
+/**
+ * Record the failure of a synchronization attempt (`-1` if cancelled)
+ */
+- (void)fail:(NSInteger)ecode;
+
+/**
+ * Record the completion of a synchronization, i.e. remove the journal file
+ */
+- (void)finish;
+
+/**
+ * Record a failure that is not worth resuming (e.g. bad credentials or a
+ * corrupt database), i.e. remove the journal file as well
+ */
+- (void)abandon:(NSInteger)ecode;
+
+@end
@@ -0,0 +1,167 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#import "MSSyncJournal.h"
+#import "MSDebug.h"
+#import "MSObjC.h"
+
+/** Smallest delay in seconds between two progress checkpoints */
+#define MS_SYNC_JOURNAL_PERIOD 1.0
+
+static NSString *kMSSyncJournalTotal     = @"total";
+static NSString *kMSSyncJournalCurrent   = @"current";
+static NSString *kMSSyncJournalAttempts  = @"attempts";
+static NSString *kMSSyncJournalLastError = @"lastError";
+
+@interface MSSyncJournal ()
+- (void)save;
+@end
+
+@implementation MSSyncJournal
+
+@synthesize path = _path;
+@dynamic pending;
+@dynamic total;
+@dynamic current;
+@dynamic attempts;
+@dynamic lastError;
+
+- (id)initWithPath:(NSString *)path {
+    self = [super init];
+    if (self) {
+        _path = [path copy];
+        _total = -1;
+        _current = 0;
+        _attempts = 0;
+        _lastError = 0;
+        _savedAt = 0;
+
+        NSDictionary *dict = [NSDictionary dictionaryWithContentsOfFile:_path];
+        _pending = (dict != nil);
+        if (_pending) {
+            _total = [[dict objectForKey:kMSSyncJournalTotal] integerValue];
+            _current = [[dict objectForKey:kMSSyncJournalCurrent] integerValue];
+            _attempts = [[dict objectForKey:kMSSyncJournalAttempts] integerValue];
+            _lastError = [[dict objectForKey:kMSSyncJournalLastError] integerValue];
+            MSDLog(@" [SYNC JOURNAL] PENDING SYNC: %d/%d AFTER %d ATTEMPT(S)",
+                   (int) _current, (int) _total, (int) _attempts);
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [_path release_stub];
+    _path = nil;
+
+#if ! __has_feature(objc_arc)
+    [super dealloc];
+#endif
+}
+
+- (BOOL)isPending {
+    @synchronized(self) {
+        return _pending;
+    }
+}
+
+- (NSInteger)total {
+    @synchronized(self) {
+        return _total;
+    }
+}
+
+- (NSInteger)current {
+    @synchronized(self) {
+        return _current;
+    }
+}
+
+- (NSInteger)attempts {
+    @synchronized(self) {
+        return _attempts;
+    }
+}
+
+- (NSInteger)lastError {
+    @synchronized(self) {
+        return _lastError;
+    }
+}
+
+- (void)begin {
+    @synchronized(self) {
+        _pending = YES;
+        _attempts++;
+        [self save];
+    }
+}
+
+- (void)progress:(NSInteger)current total:(NSInteger)total {
+    @synchronized(self) {
+        _current = current;
+        _total = total;
+        if (CFAbsoluteTimeGetCurrent() - _savedAt >= MS_SYNC_JOURNAL_PERIOD)
+            [self save];
+    }
+}
+
+- (void)fail:(NSInteger)ecode {
+    @synchronized(self) {
+        _lastError = ecode;
+        [self save];
+    }
+}
+
+- (void)finish {
+    @synchronized(self) {
+        _pending = NO;
+        _total = -1;
+        _current = 0;
+        _attempts = 0;
+        _lastError = 0;
+        [[NSFileManager defaultManager] removeItemAtPath:_path error:nil];
+    }
+}
+
+- (void)abandon:(NSInteger)ecode {
+    MSDLog(@" [SYNC JOURNAL] ABANDONED AFTER %d ATTEMPT(S) (ERROR %d)", (int) [self attempts], (int) ecode);
+    [self finish];
+}
+
+#pragma mark - Private
+
+// NOTE: the lock must be held
+- (void)save {
+    NSDictionary *dict = [NSDictionary dictionaryWithObjectsAndKeys:
+                          [NSNumber numberWithInteger:_total], kMSSyncJournalTotal,
+                          [NSNumber numberWithInteger:_current], kMSSyncJournalCurrent,
+                          [NSNumber numberWithInteger:_attempts], kMSSyncJournalAttempts,
+                          [NSNumber numberWithInteger:_lastError], kMSSyncJournalLastError,
+                          nil];
+    if (![dict writeToFile:_path atomically:YES])
+        MSDLog(@" [SYNC JOURNAL] CAN'T WRITE %@", _path);
+    _savedAt = CFAbsoluteTimeGetCurrent();
+}
+
+@end
@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdint.h>
+
+#import "MSHistogram.h"
+
+/**
+ * Latency tracing
+ * --
+ * Each traced thread records its events (stage, start time and duration) into
+ * its own ring buffer without taking any lock. The rings are drained into one
+ * latency histogram per stage when a snapshot is taken, or by the recording
+ * thread itself once its ring is half full if nobody else is draining.
+ *
+ * Events recorded while a ring is full are dropped (and counted).
+ *
+ * Usage:
+ *
+ *     uint64_t t = MSTraceNow();
+ *     ... traced work ...
+ *     MSTraceRecord(MS_TRACE_SEARCH, t);
+ */
+
+/** Traced stages */
+typedef enum {
+    MS_TRACE_FRAME = 0,     /* camera frame, from its arrival to the end of its scan */
+    MS_TRACE_IMAGE,         /* query image creation */
+    MS_TRACE_SEARCH,        /* offline image search */
+    MS_TRACE_MATCH,         /* offline image match */
+    MS_TRACE_DECODE,        /* barcode decoding */
+    MS_TRACE_API,           /* online search round-trip */
+    MS_TRACE_SYNC,          /* synchronization download */
+    MS_TRACE_SWAP,          /* swap of the synchronized database */
+    MS_TRACE_MULTI,         /* multi-code decoding (location and parallel decodes) */
+    MS_TRACE_STAGES         /* number of stages - do not use! */
+} MSTraceStage;
+
+typedef struct {
+    MSHistogram stages[MS_TRACE_STAGES];
+    uint64_t events;        /* number of recorded events */
+    uint64_t dropped;       /* number of events dropped because a ring was full */
+    double cost;            /* measured cost of `MSTraceRecord` in seconds */
+} MSTraceStats;
+
+/**
+ * Monotonic time in microseconds
+ */
+uint64_t MSTraceNow(void);
+
+/**
+ * Record an event of the given stage that started at `start` (see `MSTraceNow`)
+ * and ends now
+ */
+void MSTraceRecord(MSTraceStage stage, uint64_t start);
+
+/**
+ * Enable or disable the tracing (default: enabled)
+ */
+void MSTraceSetEnabled(int enabled);
+
+/**
+ * Drain the rings and get the histograms of all the events recorded so far
+ */
+void MSTraceSnapshot(MSTraceStats *stats);
+
+/**
+ * Drain the rings and clear the histograms
+ */
+void MSTraceReset(void);
+
+/**
+ * Short name of a stage, e.g. "search"
+ */
+const char *MSTraceStageName(MSTraceStage stage);
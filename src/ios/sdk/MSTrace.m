@@ -0,0 +1,207 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#import "MSTrace.h"
+
+#include <libkern/OSAtomic.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Number of events per thread ring (must be a power of two) */
+#define MS_TRACE_RING 512
+
+/** Number of calls timed to measure the cost of `MSTraceRecord` */
+#define MS_TRACE_CALIBRATION 1024
+
+typedef struct {
+    uint32_t stage;
+    uint32_t duration;      /* microseconds */
+    uint64_t start;         /* microseconds */
+} ms_trace_event;
+
+/**
+ * Per-thread ring: the thread is its only producer and whoever holds `gLock`
+ * its only consumer
+ */
+typedef struct ms_trace_ring {
+    ms_trace_event events[MS_TRACE_RING];
+    volatile uint32_t head;     /* written by the producer */
+    volatile uint32_t tail;     /* written by the consumer */
+    volatile int32_t dropped;
+    volatile int32_t dead;      /* set when the thread exits */
+    struct ms_trace_ring *next;
+} ms_trace_ring;
+
+static pthread_once_t gOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;
+static pthread_mutex_t gLock = PTHREAD_MUTEX_INITIALIZER;
+static ms_trace_ring *gRings = NULL;
+static MSTraceStats gStats;
+static volatile int gEnabled = 1;
+static mach_timebase_info_data_t gTimebase;
+
+static const char *kMSTraceStageNames[MS_TRACE_STAGES] = {
+    "frame", "image", "search", "match", "decode", "api", "sync", "swap", "multi"
+};
+
+static void ms_trace_ring_exit(void *ring) {
+    OSMemoryBarrier();
+    ((ms_trace_ring *) ring)->dead = 1;
+}
+
+static void ms_trace_init(void) {
+    mach_timebase_info(&gTimebase);
+    pthread_key_create(&gKey, ms_trace_ring_exit);
+    memset(&gStats, 0, sizeof(gStats));
+}
+
+static ms_trace_ring *ms_trace_ring_get(void) {
+    pthread_once(&gOnce, ms_trace_init);
+    ms_trace_ring *ring = (ms_trace_ring *) pthread_getspecific(gKey);
+    if (ring == NULL) {
+        ring = (ms_trace_ring *) calloc(1, sizeof(*ring));
+        if (ring == NULL) return NULL;
+        pthread_mutex_lock(&gLock);
+        ring->next = gRings;
+        gRings = ring;
+        pthread_mutex_unlock(&gLock);
+        pthread_setspecific(gKey, ring);
+    }
+    return ring;
+}
+
+/* NOTE: the caller must hold `gLock` */
+static void ms_trace_drain(ms_trace_ring *ring) {
+    uint32_t head = ring->head;
+    OSMemoryBarrier();
+    for (uint32_t t = ring->tail; t != head; t++) {
+        const ms_trace_event *e = &ring->events[t & (MS_TRACE_RING - 1)];
+        if (e->stage < MS_TRACE_STAGES)
+            MSHistogramAdd(&gStats.stages[e->stage], e->duration / 1e6);
+        gStats.events++;
+    }
+    OSMemoryBarrier();
+    ring->tail = head;
+
+    int32_t dropped = ring->dropped;
+    if (dropped > 0) {
+        OSAtomicAdd32(-dropped, &ring->dropped);
+        gStats.dropped += dropped;
+    }
+}
+
+/* NOTE: the caller must hold `gLock` */
+static void ms_trace_drain_all(void) {
+    ms_trace_ring **link = &gRings;
+    while (*link != NULL) {
+        ms_trace_ring *ring = *link;
+        int dead = ring->dead;
+        ms_trace_drain(ring);
+        if (dead) {
+            // Nothing can be recorded into it anymore
+            *link = ring->next;
+            free(ring);
+        }
+        else {
+            link = &ring->next;
+        }
+    }
+}
+
+/* Returns 0 if the event has been dropped */
+static int ms_trace_push(ms_trace_ring *ring, MSTraceStage stage, uint64_t start, uint64_t now) {
+    uint32_t head = ring->head;
+    if (head - ring->tail >= MS_TRACE_RING) {
+        OSAtomicIncrement32(&ring->dropped);
+        return 0;
+    }
+    ms_trace_event *e = &ring->events[head & (MS_TRACE_RING - 1)];
+    e->stage = stage;
+    e->duration = (now > start) ? (uint32_t) (now - start) : 0;
+    e->start = start;
+    OSMemoryBarrier();
+    ring->head = head + 1;
+    return 1;
+}
+
+uint64_t MSTraceNow(void) {
+    pthread_once(&gOnce, ms_trace_init);
+    return (mach_absolute_time() * gTimebase.numer / gTimebase.denom) / 1000;
+}
+
+void MSTraceRecord(MSTraceStage stage, uint64_t start) {
+    if (!gEnabled) return;
+    ms_trace_ring *ring = ms_trace_ring_get();
+    if (ring == NULL) return;
+
+    ms_trace_push(ring, stage, start, MSTraceNow());
+
+    // Drain our own ring if nobody did it for a while (never wait for the lock)
+    if (ring->head - ring->tail >= MS_TRACE_RING / 2 && pthread_mutex_trylock(&gLock) == 0) {
+        ms_trace_drain(ring);
+        pthread_mutex_unlock(&gLock);
+    }
+}
+
+void MSTraceSetEnabled(int enabled) {
+    gEnabled = enabled;
+}
+
+void MSTraceSnapshot(MSTraceStats *stats) {
+    pthread_once(&gOnce, ms_trace_init);
+
+    // Time the recording path on a private ring so that it does not show up
+    ms_trace_ring *scratch = (ms_trace_ring *) calloc(1, sizeof(*scratch));
+    double cost = 0;
+    if (scratch != NULL) {
+        uint64_t t0 = MSTraceNow();
+        for (int i = 0; i < MS_TRACE_CALIBRATION; i++) {
+            ms_trace_push(scratch, MS_TRACE_FRAME, t0, MSTraceNow());
+            scratch->tail = scratch->head;
+        }
+        cost = (MSTraceNow() - t0) / 1e6 / MS_TRACE_CALIBRATION;
+        free(scratch);
+    }
+
+    pthread_mutex_lock(&gLock);
+    ms_trace_drain_all();
+    gStats.cost = cost;
+    *stats = gStats;
+    pthread_mutex_unlock(&gLock);
+}
+
+void MSTraceReset(void) {
+    pthread_once(&gOnce, ms_trace_init);
+
+    pthread_mutex_lock(&gLock);
+    ms_trace_drain_all();
+    memset(&gStats, 0, sizeof(gStats));
+    pthread_mutex_unlock(&gLock);
+}
+
+const char *MSTraceStageName(MSTraceStage stage) {
+    return (stage < MS_TRACE_STAGES) ? kMSTraceStageNames[stage] : "unknown";
+}
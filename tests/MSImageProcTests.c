@@ -0,0 +1,258 @@
+/**
+ * Copyright (c) 2013 Moodstocks SAS
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * Image kernels tests
+ * --
+ * `MSImageProc.m` is built twice (see `Makefile`): once as shipped, i.e. with
+ * the NEON kernels whenever the host supports them, and once with the scalar
+ * kernels only, renamed with a `ms_scalar_` prefix. The tests check both
+ * builds against known values then check that they produce the same bytes.
+ *
+ * On a host without NEON both builds run the scalar code: run `make check` on
+ * an ARM host (e.g. Apple silicon) to actually compare the NEON kernels.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MSImageProc.h"
+
+void ms_scalar_MSGrayFromPlane(const MSPlane *src, uint8_t *dst, int dbpr);
+void ms_scalar_MSGrayDownscale2x(const uint8_t *src, int w, int h, int sbpr,
+                                 uint8_t *dst, int dbpr);
+
+static int failures = 0;
+
+#define CHECK(cond) do {                                              \
+    if (!(cond)) {                                                    \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                  \
+                __FILE__, __LINE__, #cond);                           \
+        failures++;                                                   \
+    }                                                                 \
+} while (0)
+
+static void fill_random(uint8_t *buf, int n) {
+    for (int i = 0; i < n; i++)
+        buf[i] = (uint8_t) (rand() & 0xff);
+}
+
+#pragma mark - Known values
+
+static void test_gray_from_rgb32(void) {
+    /* BGRA pixels */
+    const uint8_t px[] = {
+        255, 255, 255, 255,  /* white */
+          0,   0,   0, 255,  /* black */
+          0,   0, 255, 255,  /* red */
+          0, 255,   0, 255,  /* green */
+        255,   0,   0, 255,  /* blue */
+    };
+    const uint8_t expected[] = { 255, 0, 77, 149, 29 };
+    const MSPlane plane = { px, 5, 1, sizeof(px), MS_PIX_FMT_RGB32 };
+    uint8_t dst[5];
+    MSGrayFromPlane(&plane, dst, 5);
+    CHECK(memcmp(dst, expected, 5) == 0);
+    ms_scalar_MSGrayFromPlane(&plane, dst, 5);
+    CHECK(memcmp(dst, expected, 5) == 0);
+}
+
+static void test_gray_from_gray8(void) {
+    /* 3x2 plane with 2 bytes of row padding */
+    const uint8_t px[] = { 1, 2, 3, 0xee, 0xee, 4, 5, 6, 0xee, 0xee };
+    const MSPlane plane = { px, 3, 2, 5, MS_PIX_FMT_GRAY8 };
+    uint8_t dst[8];
+    memset(dst, 0xaa, sizeof(dst));
+    MSGrayFromPlane(&plane, dst, 4);
+    const uint8_t expected[] = { 1, 2, 3, 0xaa, 4, 5, 6, 0xaa };
+    CHECK(memcmp(dst, expected, sizeof(dst)) == 0);
+}
+
+static void test_downscale2x(void) {
+    /* 5x3 image: the last column and row are dropped */
+    const uint8_t src[] = {
+        1, 2, 0, 0, 9,
+        3, 4, 0, 1, 9,
+        9, 9, 9, 9, 9,
+    };
+    uint8_t dst[2];
+    MSGrayDownscale2x(src, 5, 3, 5, dst, 2);
+    CHECK(dst[0] == 3);  /* (1 + 2 + 3 + 4 + 2) >> 2 */
+    CHECK(dst[1] == 0);  /* (0 + 0 + 0 + 1 + 2) >> 2 */
+    ms_scalar_MSGrayDownscale2x(src, 5, 3, 5, dst, 2);
+    CHECK(dst[0] == 3);
+    CHECK(dst[1] == 0);
+}
+
+static void test_resize(void) {
+    enum { W = 37, H = 11 };
+    uint8_t src[W * H], dst[W * H];
+    fill_random(src, sizeof(src));
+
+    /* same size is the identity */
+    MSGrayResize(src, W, H, W, dst, W, H, W);
+    CHECK(memcmp(src, dst, sizeof(src)) == 0);
+
+    /* a flat image stays flat */
+    memset(src, 123, sizeof(src));
+    MSGrayResize(src, W, H, W, dst, 23, 7, 23);
+    int flat = 1;
+    for (int i = 0; i < 23 * 7; i++)
+        flat &= (dst[i] == 123);
+    CHECK(flat);
+
+    /* halfway between two columns */
+    const uint8_t ramp[] = { 0, 100, 200, 0, 100, 200 };
+    uint8_t out[2];
+    MSGrayResize(ramp, 3, 2, 3, out, 2, 1, 2);
+    CHECK(out[0] == 25);   /* 1/4 of the way from 0 to 100 */
+    CHECK(out[1] == 175);  /* 3/4 of the way from 100 to 200 */
+}
+
+static void test_dhash(void) {
+    enum { W = 36, H = 16 };
+    uint8_t img[W * H];
+
+    memset(img, 80, sizeof(img));
+    CHECK(MSGrayDHash(img, W, H) == 0);
+
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            img[y * W + x] = (uint8_t) (7 * x);
+    CHECK(MSGrayDHash(img, W, H) == UINT64_MAX);
+
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            img[y * W + x] = (uint8_t) (255 - 7 * x);
+    CHECK(MSGrayDHash(img, W, H) == 0);
+
+    CHECK(MSHammingDistance(0, UINT64_MAX) == 64);
+    CHECK(MSHammingDistance(0x5, 0x6) == 2);
+}
+
+static void test_ncc(void) {
+    enum { W = 20, H = 12, PW = 6, PH = 5, X = 7, Y = 4 };
+    uint8_t img[W * H], patch[PW * PH];
+    fill_random(img, sizeof(img));
+
+    for (int j = 0; j < PH; j++)
+        memcpy(patch + j * PW, img + (Y + j) * W + X, PW);
+    CHECK(fabsf(MSGrayNCC(img, W, X, Y, patch, PW, PH) - 1.0f) < 1e-5f);
+
+    /* exposure changes do not matter */
+    for (int i = 0; i < PW * PH; i++)
+        patch[i] = (uint8_t) (patch[i] / 2 + 10);
+    CHECK(MSGrayNCC(img, W, X, Y, patch, PW, PH) > 0.99f);
+
+    for (int j = 0; j < PH; j++)
+        for (int i = 0; i < PW; i++)
+            patch[j * PW + i] = (uint8_t) (255 - img[(Y + j) * W + X + i]);
+    CHECK(fabsf(MSGrayNCC(img, W, X, Y, patch, PW, PH) + 1.0f) < 1e-5f);
+
+    memset(patch, 42, sizeof(patch));
+    CHECK(MSGrayNCC(img, W, X, Y, patch, PW, PH) == 0.0f);
+}
+
+#pragma mark - NEON vs scalar
+
+static void test_exact_gray_from_plane(void) {
+    /* widths around the 8 pixels NEON step to cover the scalar tails */
+    for (int w = 1; w <= 67; w++) {
+        const int h = 1 + w % 5;
+        const int sbpr = 4 * w + 12;
+        const int dbpr = w + 3;
+        uint8_t *src = malloc(sbpr * h);
+        uint8_t *a = malloc(dbpr * h);
+        uint8_t *b = malloc(dbpr * h);
+        fill_random(src, sbpr * h);
+        memset(a, 0, dbpr * h);
+        memset(b, 0, dbpr * h);
+
+        const MSPlane plane = { src, w, h, sbpr, MS_PIX_FMT_RGB32 };
+        MSGrayFromPlane(&plane, a, dbpr);
+        ms_scalar_MSGrayFromPlane(&plane, b, dbpr);
+        CHECK(memcmp(a, b, dbpr * h) == 0);
+
+        free(src);
+        free(a);
+        free(b);
+    }
+}
+
+static void test_exact_downscale2x(void) {
+    for (int w = 2; w <= 70; w++) {
+        const int h = 2 + w % 7;
+        const int sbpr = w + 5;
+        const int dbpr = w / 2 + 1;
+        uint8_t *src = malloc(sbpr * h);
+        uint8_t *a = malloc(sbpr * h);
+        uint8_t *b = malloc(sbpr * h);
+        fill_random(src, sbpr * h);
+        memset(a, 0, sbpr * h);
+        memset(b, 0, sbpr * h);
+
+        MSGrayDownscale2x(src, w, h, sbpr, a, dbpr);
+        ms_scalar_MSGrayDownscale2x(src, w, h, sbpr, b, dbpr);
+        CHECK(memcmp(a, b, dbpr * (h / 2)) == 0);
+
+        /* in place */
+        memcpy(a, src, sbpr * h);
+        memcpy(b, src, sbpr * h);
+        MSGrayDownscale2x(a, w, h, sbpr, a, sbpr);
+        ms_scalar_MSGrayDownscale2x(b, w, h, sbpr, b, sbpr);
+        CHECK(memcmp(a, b, sbpr * h) == 0);
+
+        free(src);
+        free(a);
+        free(b);
+    }
+}
+
+int main(void) {
+    srand(1);
+
+    test_gray_from_rgb32();
+    test_gray_from_gray8();
+    test_downscale2x();
+    test_resize();
+    test_dhash();
+    test_ncc();
+
+    test_exact_gray_from_plane();
+    test_exact_downscale2x();
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    printf("NEON kernels compared against the scalar ones\n");
+#else
+    printf("no NEON on this host: scalar kernels only\n");
+#endif
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
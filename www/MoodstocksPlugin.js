@@ -1,3 +1,31 @@
+// Scan formats
+var scanFormats = {
+    ean8: 1 << 0,                /* EAN8 linear barcode */
+    ean13: 1 << 1,               /* EAN13 linear barcode */
+    qrcode: 1 << 2,              /* QR Code 2D barcode */
+    dmtx: 1 << 3,                /* Datamatrix 2D barcode */
+    image: 1 << 31               /* Image match */
+}
+
+var resultFormats = {
+    none: "None",
+    ean8: "EAN8",
+    ean13: "EAN13",
+    qrcode: "QR CODE",
+    dmtx: "DATA MATRIX",
+    image: "IMAGE"
+}
+
+// Get the name of a scan result format
+function resultFormat(format) {
+    for (strFormat in scanFormats) {
+        if (format === scanFormats[strFormat]) {
+            return resultFormats[strFormat];
+        }
+    }
+    return resultFormats.none;
+}
+
 var MoodstocksPlugin = {
 
     // Load scanner with given api key & api secret pair
@@ -24,6 +52,11 @@ var MoodstocksPlugin = {
     },
 
     // Sync the cache
+    //
+    // `finished` receives the changes brought by the sync, i.e. an object with:
+    // - `added`: array of the added image IDs,
+    // - `removed`: array of the removed image IDs,
+    // - `unchanged`: number of images left as is.
     sync: function(isReady, inProgress, finished, fail) {
         function successWrapper(result) {
             switch(result.status) {
@@ -34,7 +67,7 @@ var MoodstocksPlugin = {
                     inProgress.call(null, result.progress);
                     break;
                 case 3:
-                    finished.call(null);
+                    finished.call(null, result.changes);
                     break;
                 case 0:
                     fail.call(null, result.message);
@@ -83,35 +116,184 @@ var MoodstocksPlugin = {
         return cordova.exec(successWrapper, fail, "MoodstocksPlugin", "sync", []);
     },
 
-    // Launch the scanner
-    scan: function(success, fail, scanOptions) {
-        // Scan formats
-        var scanFormats = {
-            ean8: 1 << 0,                /* EAN8 linear barcode */
-            ean13: 1 << 1,               /* EAN13 linear barcode */
-            qrcode: 1 << 2,              /* QR Code 2D barcode */
-            dmtx: 1 << 3,                /* Datamatrix 2D barcode */
-            image: 1 << 31               /* Image match */
+    // Get a page of the image IDs recorded into the cache
+    //
+    // `options` (optional) may hold:
+    // - `offset`: index of the first ID to return (default: 0),
+    // - `limit`: maximum number of IDs to return (default: 100),
+    // - `prefix`: only consider the IDs starting with this string.
+    //
+    // `success` receives the page, i.e. an object with:
+    // - `ids`: array of image IDs sorted in lexicographic order,
+    // - `offset`: index of the first returned ID,
+    // - `total`: total number of IDs matching the prefix.
+    info: function(success, fail, options) {
+        if (!fail) {
+            fail = function() {}
+        }
+
+        if (!success) {
+            success = function() {}
+        }
+
+        if (!options) {
+            options = {};
+        }
+
+        if (typeof fail != "function") {
+            console.log("fail callback parameter must be a function");
+            return;
         }
 
-        var resultFormats = {
-            none: "None",
-            ean8: "EAN8",
-            ean13: "EAN13",
-            qrcode: "QR CODE",
-            dmtx: "DATA MATRIX",
-            image: "IMAGE"
+        if (typeof success != "function") {
+            console.log("success callback parameter must be a function");
+            return;
         }
 
+        var offset = options.offset || 0;
+        var limit = (options.limit !== undefined) ? options.limit : 100;
+        var prefix = options.prefix || "";
+
+        return cordova.exec(success, fail, "MoodstocksPlugin", "info", [offset, limit, prefix]);
+    },
+
+    // Get the performance counters collected since the application started
+    //
+    // `success` receives an object with:
+    // - `latency`: for each traced stage (`frame`, `image`, `search`, `match`,
+    //   `decode`, `api`, `sync`, `swap`, `multi`), an object with the number of events
+    //   (`count`) and their `mean`, `p50`, `p90`, `p99` and `max` durations in ms,
+    // - `tracing`: number of traced `events`, number of `dropped` ones and
+    //   `cost` of tracing one event in ns,
+    // - `pool`: pixel buffers pool counters (leases served by a pooled buffer
+    //   `hits`, leases that required an allocation `misses`, `residentBytes`
+    //   currently allocated and `peakBytes`),
+    // - `api`: online search counters, with the latency of the hybrid searches
+    //   per winning path (`hybrid` object with `local`, `api` and `none` keys,
+    //   same format as `latency`),
+    // - `access`: database access counters (`waitTime` in ms),
+    // - `results`: results storage counters (number of distinct results `live`
+    //   in memory, `created` so far and `reused` instead of being created),
+    // - `multi`: multi-code decoding counters (number of `frames`, of located
+    //   `regions`, of `decodes` and of distinct `codes` found),
+    // - `queue`: offline queue counters (`oldestAge` in seconds),
+    // - `sync`: number of sync progress reports `produced` by the SDK and
+    //   `delivered` to the delegates,
+    // - `generation`: number of synchronizations swapped in.
+    //
+    // `options` (optional) may hold:
+    // - `reset`: clear the latency histograms once read (default: false).
+    stats: function(success, fail, options) {
+        if (!fail) {
+            fail = function() {}
+        }
+
+        if (!success) {
+            success = function() {}
+        }
+
+        if (!options) {
+            options = {};
+        }
+
+        if (typeof fail != "function") {
+            console.log("fail callback parameter must be a function");
+            return;
+        }
+
+        if (typeof success != "function") {
+            console.log("success callback parameter must be a function");
+            return;
+        }
+
+        return cordova.exec(success, fail, "MoodstocksPlugin", "stats", [!!options.reset]);
+    },
+
+    // Get the results of the searches queued while offline
+    //
+    // When the scanner has no connection the query is saved on disk and searched
+    // again as soon as the network is back. `found` is called for each of them
+    // (possibly long after the scan) with the scan result's type and value
+    // (`None` and null in case of no match found) and an object with:
+    // - `id`: identifier of the queued query,
+    // - `timestamp`: time at which the query has been queued (ms since 1970),
+    // - `attempts`: number of failed re-submissions before this one,
+    // - `pending`: number of queries still in the queue.
+    //
+    // `fail` is called with an error message and the same object when a query
+    // is dropped after too many failed attempts.
+    queue: function(found, fail) {
+        function successWrapper(result) {
+            var query = {
+                id: result.id,
+                timestamp: result.timestamp,
+                attempts: result.attempts,
+                pending: result.pending
+            }
+
+            if (result.error !== undefined) {
+                fail.call(null, result.error, query);
+            }
+            else if (result.value !== undefined) {
+                found.call(null, resultFormat(result.format), result.value, query);
+            }
+            else {
+                found.call(null, resultFormats.none, null, query);
+            }
+        }
+
+        if (!fail) {
+            fail = function() {}
+        }
+
+        if (!found) {
+            found = function() {}
+        }
+
+        if (typeof fail != "function") {
+            console.log("fail callback parameter must be a function");
+            return;
+        }
+
+        if (typeof found != "function") {
+            console.log("found callback parameter must be a function");
+            return;
+        }
+
+        return cordova.exec(successWrapper, fail, "MoodstocksPlugin", "queue", []);
+    },
+
+    // Launch the scanner
+    //
+    // By default the scanner is dismissed as soon as a result is found. With the
+    // `continuous` scan option it keeps scanning instead and `success` is called
+    // for each new result until the user taps `Done` or `stop` is called. It then
+    // accepts:
+    // - `window`: time during which a result that keeps being scanned is not
+    //   reported again, in seconds (default: 5),
+    // - `interval`: time during which new results are gathered before being sent
+    //   at once, in ms (default: 500).
+    //
+    // `finished` (continuous mode only) is called once the scanner is dismissed
+    // with an object holding the number of `items` found, the number of
+    // `messages` sent to the WebView, the `duration` in seconds, as well as the
+    // `itemsPerMinute` and `messagesPerSecond` rates.
+    scan: function(success, fail, scanOptions, finished) {
         // Wrap the success callback with scan result's type and value
         function successWrapper(result) {
-            for (strFormat in scanFormats) {
-                if (result.format === scanFormats[strFormat]) {
-                    success.call(null, resultFormats[strFormat], result.value);
-                    return;
-                }
+            if (result.results === undefined) {
+                var format = resultFormat(result.format);
+                success.call(null, format, (format === resultFormats.none) ? null : result.value);
+                return;
+            }
+
+            for (var i = 0; i < result.results.length; i++) {
+                success.call(null, resultFormat(result.results[i].format), result.results[i].value);
+            }
+
+            if (result.summary !== undefined) {
+                finished.call(null, result.summary);
             }
-            success.call(null, resultFormats.none, null);
         }
 
         if (!fail) {
@@ -122,6 +304,10 @@ var MoodstocksPlugin = {
             success = function() {}
         }
 
+        if (!finished) {
+            finished = function() {}
+        }
+
         if (!scanOptions) {
             scanOptions = {image: true};
         }
@@ -136,6 +322,11 @@ var MoodstocksPlugin = {
             return;
         }
 
+        if (typeof finished != "function") {
+            console.log("finished callback parameter must be a function");
+            return;
+        }
+
         var formats = 0;
         // Set the scan options according to the user choices
         for (strFormat in scanFormats) {
@@ -144,7 +335,34 @@ var MoodstocksPlugin = {
             }
         }
 
-        return cordova.exec(successWrapper, fail, "MoodstocksPlugin", "scan", [formats]);
+        var continuous = !!scanOptions.continuous;
+        var window = scanOptions.window || 0;
+        var interval = scanOptions.interval || 0;
+
+        return cordova.exec(successWrapper, fail, "MoodstocksPlugin", "scan", [formats, continuous, window, interval]);
+    },
+
+    // Dismiss the scanner, if any (e.g. to end a continuous scan)
+    stop: function(success, fail) {
+        if (!fail) {
+            fail = function() {}
+        }
+
+        if (!success) {
+            success = function() {}
+        }
+
+        if (typeof fail != "function") {
+            console.log("fail callback parameter must be a function");
+            return;
+        }
+
+        if (typeof success != "function") {
+            console.log("success callback parameter must be a function");
+            return;
+        }
+
+        return cordova.exec(success, fail, "MoodstocksPlugin", "stop", []);
     }
 
 }